@@ -1,3 +1,9 @@
+/***** Feature test macro - compiler complains about getline() *****/
+// these have to come before any #include to have an effect
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -10,11 +16,17 @@
 #include <time.h>
 #include <stdarg.h> // allows functions to accept an indefinite number of arguments
 #include <fcntl.h>
-
-/***** Feature test macro - compiler complains about getline() *****/
-#define _DEFAULT_SOURCE
-#define _BSD_SOURCE
-#define _GNU_SOURCE
+#include <stddef.h> // offsetof
+#include <sys/mman.h> // mmap, to open files without reading them into memory
+#include <sys/stat.h>
+#include <sys/uio.h> // writev, see editorSave()
+#include <limits.h> // IOV_MAX, PATH_MAX
+#include <poll.h>
+#include <signal.h> // SIGWINCH, see Event Loop
+#include <pthread.h> // worker threads, see Thread Pool. Build with -pthread
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SSE2/AVX2 intrinsics, picked at runtime with __builtin_cpu_supports()
+#endif
 
 /***** defines *****/
 #define CTRL_KEY(k) ((k) & 0x1f) // if k is A which is 65 then 65 & 31. 0x1f = 0001 1111
@@ -23,7 +35,62 @@
 #define ONREE_QUIT_TIMES 3 // require the user to press ctrl-q 3 more times in order to quit w/o saving
 #define HL_HIGHLIGHT_NUMBERS (1<<0) // shifting 1 to the left by 0 position, result 1
 #define HL_HIGHLIGHT_STRINGS (1<<1) // resutl 2
-
+#define LEX_SEP (1<<0) // what a byte can be to the lexer, see syntaxCompile(). A separator, see is_separator()
+#define LEX_DIGIT (1<<1) // starts or goes on with a number
+#define LEX_DOT (1<<2) // goes on with a number
+#define LEX_QUOTE (1<<3) // starts a string
+#define LEX_COMMENT (1<<4) // the first char of a comment start
+#define ONREE_RENDER_CACHE 1024 // # rows that keep their render & hl around after being drawn
+#define ONREE_HL_BUDGET 2000 // most rows redone per frame after a change in multi-line comment state, the rest is redone when idle
+#define INPUT_BUF_SIZE 65536 // bytes taken from the terminal with one read()
+#define PASTE_TIMEOUTS 10 // a paste that stops for this many read timeouts (1 second) without its end marker is taken as finished
+#define ONREE_KEY_TIMEOUT 100 // ms to wait for the rest of an escape sequence
+#define ONREE_FPS 60 // most frames drawn per second, the ONREE_FPS environment variable changes it
+#define ONREE_IDLE_DELAY 0.1 // seconds without a key before the work in editorIdle() is done
+#define ONREE_STATUS_SECONDS 5 // how long a status message stays on screen
+#define ONREE_STATS_FILE "onree-stats.txt" // where the stats are written at exit once they've been shown, the ONREE_STATS_FILE environment variable changes it
+#define STAT_BUCKETS 512 // latency histogram buckets, 8 per power of 2 of ns
+#define SAVE_BLOCK (1 << 20) // loaded rows are copied for a save in blocks of about 1MB
+#define SAVE_POLL 0.1 // seconds between progress updates of a save
+#define UNDO_CHUNK (64 << 10) // the undo history is kept in chunks of 64KB
+#define UNDO_CAP_MB 64 // most MB of undo history, the ONREE_UNDO_MB environment variable changes it
+#define UNDO_COALESCE_MAX 256 // most chars typed (or backspaced) in a row that are undone together
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define POOL_MAX_THREADS 64
+#define LINE_CHUNK_SIZE (4 << 20) // files are scanned for line endings in chunks of about 4MB
+#define SEARCH_RANGE_BYTES (1 << 20) // each search task looks through about 1MB of text
+#define SEARCH_RANGE_ROWS 4096 // or this many loaded rows
+#define HL_BLOCK_ROWS 4096 // rows highlighted by one task when every row is highlighted at once
+#define KEYWORD_TABLE_GROWTH 64 // a keyword table may grow to this many times its first size before the keywords are given up on
+#define REGEX_MAX_NODES 100000 // patterns that compile to more NFA nodes than this are refused, x{1000}{1000} would be a million
+#define REGEX_DFA_STATES 2048 // a lazy DFA throws its states away & starts over when it has this many
+#define BENCH_MB (1L << 20)
+#define BENCH_JSON_LINE (4 << 20) // the JSON corpus is minified, one line every 4MB
+#define ROW_SLAB_SIZE (256 << 10) // loaded rows are cut out of slabs of 256KB
+#define ROW_CLASSES 17 // block sizes, see ROW_CLASS_SIZE
+#define ROW_CLASS_MAX 4096 // blocks bigger than this come straight from malloc
+#define ROW_LONG (64 << 10) // rows longer than this are kept in chunks, see Long Rows
+#define ROW_CHUNK 2048 // most chars in a chunk, the size of its block
+#define ROW_CHUNK_FILL 1792 // chars put in a new chunk, the rest is room to type into
+#define ROW_CHUNK_WINDOW 64 // chars after a chunk the lexer may read to finish a token there, more than the longest built-in keyword
+
+
+/* each filetype's keywords go in a hash table with no collisions (a perfect hash), built once at startup.
+Looking a word up is one hash of the word and one compare, however many keywords there are */
+typedef struct keywordSlot{
+        const char *word; // NULL for an empty slot
+        int len; // without the '|', a word from a syntax file can be any length
+        unsigned char type; // HL_KEYWORD1 or HL_KEYWORD2
+} keywordSlot;
+
+typedef struct keywordTable{
+        keywordSlot *slots;
+        unsigned int mask; // # slots - 1, # slots is a power of 2
+        unsigned int seed; // the hash seed that gave every keyword its own slot
+        int minlen, maxlen; // words of any other length can't be keywords
+} keywordTable;
 
 struct editorSyntax {
         char *filetype; // filetype field is the name of the filetype that will be displayed to the user in the status bar
@@ -32,7 +99,10 @@ struct editorSyntax {
         char *singleline_comment_start;
         char *multiline_comment_start; // "/*"
         char *multiline_comment_end;// "*/""
+        char *quotes; // the chars a string starts & ends with
         int flags; // bit field that will contain flags for whether to highlight numbers and whether to highlight strings for that filetype
+        keywordTable *kwtable; // keywords, built from keywords by syntaxCompile()
+        unsigned char lex[256]; // LEX_ bits of every byte, built by syntaxCompile(): the lexer looks a byte up instead of comparing it with each delimiter
 };
 
 /*** filetypes ***/
@@ -41,16 +111,20 @@ char *C_HL_extensions[] = { ".c", ".h", ".cpp", NULL }; // for the filematch
 char *CH_HLk_keywords[] = {"switch", "if", "while", "for", "break", "continue", "return", "else", "struct", "union", "typedef", "static", "enum", "class", "case", "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "void|" , NULL};
 
 
-struct editorSyntax HLDB[] = { // HLDB means highlight database
+struct editorSyntax HLDB_BUILTIN[] = { // for when there's no syntax file, see Syntax Files
         { // this is 1 struct in an array of struct
                 "c", // filetype field
                 C_HL_extensions, // filematch field
                 CH_HLk_keywords,
                 "//", "/*", "*/",
-                HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS 
+                "\"'",
+                HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+                NULL, // kwtable, built at startup
+                {0} // lex, the same
         },
 };
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0])) // store the length of HLDB
+struct editorSyntax *HLDB = HLDB_BUILTIN; // HLDB means highlight database: the built-in filetypes, then the ones read from syntax files
+unsigned int HLDB_ENTRIES = sizeof(HLDB_BUILTIN) / sizeof(HLDB_BUILTIN[0]); // store the length of HLDB
 
 
 enum editorKey{ // defined my own data types
@@ -63,7 +137,9 @@ enum editorKey{ // defined my own data types
         HOME_KEY, // <esc>[1~, <esc>[7~, <esc>[H, or <esc>OH, depebds on the OS. will cover all cases
         END_KEY, // <esc>[4~, <esc>[8~, <esc>[F, or <esc>OF
         PAGE_UP, // <esc>[5~ 
-        PAGE_DOWN // <esc>[6~
+        PAGE_DOWN, // <esc>[6~
+        PASTE_START, // <esc>[200~, the terminal sends this before pasted text when bracketed paste is on
+        PASTE_END // <esc>[201~, and this after it
         
 };
 
@@ -79,16 +155,157 @@ enum editorHighlight{ // hl array will contain int from 0 to 255, this is either
 };
 
 /***** data *****/
+/* A row's highlighting is kept as runs of render chars with the same highlight, most rows have a few of them instead of a byte per char.
+The chars after the last run are HL_NORMAL, so a row of plain text has none */
+typedef struct hlSpan{
+        unsigned char len; // # render chars, a longer run is split
+        unsigned char hl;
+} hlSpan;
+
+#define HL_SPAN_MAX 255
+
+typedef struct tabStop{ // a tab in a row, see Tab Index
+        int cx; // index of the tab in chars
+        int rxend; // render index right after it
+} tabStop;
+
+/* Where the lexer is at some point of a line, so a line can be highlighted a piece at a time, see Long Rows.
+Only in_comment carries over to the next line */
+typedef struct hlState{
+        unsigned char in_comment; // inside a multi-line comment
+        unsigned char in_string; // the quote of the string it's inside, 0 if none
+        unsigned char prev_sep; // the char before was a separator
+        unsigned char prev_hl; // highlight of the char before
+        unsigned char line_comment; // inside a single-line comment, which goes to the end of the line
+        unsigned char skip; // chars at the start that the last token of the piece before already covered
+        unsigned char skip_hl; // their highlight
+} hlState;
+
 typedef struct erow{ // data type for storing a row of text in the edito
-        int idx; // each erow knows its onw index within the file
         int size;
         int rsize; // tab size
         char *chars; // position in the actual text stored in the chars array of erow
-        char *render; // tab char to draw on the screen, processed(copy) version of 'chars'. Represent the position in the rendered(displayed) version of a text row, where tab chars take up multiple cols
-        unsigned char *hl; // for highlight the entire strings, keywords, comments of each line. Highlighting for each row of text before display it and then rehighlight a line whenever it gets changed. Each char in the array will correspond to a char in render
+        char *render; // NULL until the row is drawn, see editorRowRender(). tab char to draw on the screen, processed(copy) version of 'chars'. Represent the position in the rendered(displayed) version of a text row, where tab chars take up multiple cols. A row with no tabs is drawn from chars, render points to them
+        hlSpan *hl; // for highlight the entire strings, keywords, comments of each line. Highlighting for each row of text before display it and then rehighlight a line whenever it gets changed. Runs of render chars with the same highlight
+        int nhl; // # runs in hl, -1 until the row is highlighted. hl is a block of exactly nhl runs, see Row Allocator
         int hl_open_comment; // whether the row ends in an unclosed multi-line comment
+        struct erow *cache_prev, *cache_next; // place in the list of rows that have a render & hl, see Render Cache
+        int charcap; // bytes in the block chars is in, what's past size + 1 is room to grow, see Row Allocator
+        int rendercap; // bytes in the block render is in, 0 when render is chars
+        tabStop *tabs; // every tab of chars in order, to convert between chars & render indexes, see Tab Index
+        int ntabs; // -1 until the first conversion builds tabs
+        int tabcap;
+        int tabvalid; // tabs[i].rxend is up to date for i < tabvalid
+        int longrow; // index + 1 in E.longs when the row is kept in chunks & chars is NULL, 0 for a row in one block, see Long Rows
 } erow; // editor row
 
+typedef struct rowChunk{ // a piece of a long row, see Long Rows
+        char *chars; // a block of ROW_CHUNK bytes
+        int size;
+        int cx, rx; // where the chunk starts in the row's chars & on screen, up to date for the chunks before the row's valid
+        int firsttab; // index of the first tab in chars, -1 if there's none
+        int tailw; // cols from after that tab to the end of the chunk, the same wherever the chunk starts since the tab ends on a tab stop
+        hlState end; // lexer state after the chunk, what the next one starts in
+} rowChunk;
+
+typedef struct rowLong{ // the chunks of a long row, in order
+        erow *row;
+        rowChunk *c;
+        int n, cap;
+        int valid; // chunks before this one have an up to date cx & rx
+        int lexfrom, lexto; // chunks whose end state may be out of date, -1 if none. Like E.hl_from & E.hl_to for rows
+        int start; // multi-line comment state the row starts in, the state of the row above
+} rowLong;
+
+/* Rows are kept in a treap (a binary search tree balanced by random priorities) ordered by their position in the file.
+Each node knows how many rows are in its subtree, so finding, inserting or deleting row n costs O(log n) instead of shifting every row after it */
+typedef struct rowNode{
+        struct rowNode *left, *right, *parent;
+        unsigned int prio; // random priority, parent always has a higher one than its children
+        int count; // # rows in this subtree, including this node
+        int nlines; // # rows this node holds: 1 for a loaded row, more for a run of lines still in the mapped file
+        int fileline; // -1 for a loaded row, else the first line of the mapped file in this run
+        erow row; // the row lives inside its node, so an erow pointer stays valid when other rows are inserted or deleted
+} rowNode;
+
+typedef struct rowPos{ // a row in the file, used to read rows one after another without loading them
+        rowNode *node;
+        int line; // which line of node, always 0 for a loaded row
+} rowPos;
+
+/* A frame is drawn into a grid of cells first, then compared with the grid of the frame before (the shadow):
+only cells that changed are sent to the terminal, see screenFlush() */
+typedef struct screenCell{
+        unsigned char ch;
+        unsigned char color; // SGR foreground color, 39 is the default color
+        unsigned char flags; // CELL_INVERSE
+} screenCell;
+
+#define CELL_INVERSE 1 // drawn with inverted colors
+#define SCREEN_GAP 8 // unchanged cells between two changes that are cheaper to send again than to move the cursor over
+
+typedef struct searchMatch{ // one match of the search query
+        int row;
+        int cx; // index into chars of the row
+        int len; // # chars matched, always the query length unless it's a regex
+} searchMatch;
+
+enum undoType{
+        UNDO_INSERT, // text put in at row, col. A split row is "\n", a paste is all of it
+        UNDO_DELETE, // text taken out at row, col. A joined row is "\n"
+        UNDO_ROW_INSERT // an empty row added at the end of the file, typing past the last row does that
+};
+
+typedef struct undoEntry{ // one edit, its text follows right after it
+        int prev; // offset of the entry before it in the same chunk, -1 if it's the first
+        int type;
+        int group; // entries with the same group are undone together
+        int row, col; // where the edit is
+        int cy, cx; // the cursor before the edit
+        int len; // bytes of text
+} undoEntry;
+
+typedef struct undoChunk{ // entries one after another, 8 byte aligned
+        struct undoChunk *older, *newer;
+        size_t size, used;
+        int last; // offset of the newest entry, -1 if there's none
+        char data[];
+} undoChunk;
+
+typedef struct undoLog{ // a stack of entries, newest on top
+        undoChunk *oldest, *newest;
+        size_t bytes; // allocated for the chunks
+} undoLog;
+
+typedef struct undoHistory{
+        undoLog done; // edits that can be undone
+        undoLog undone; // edits undone that can be redone, thrown away by the next edit
+        int group; // group of the newest entry
+        int grouping; // > 0 between undoBegin() & undoEnd(), everything recorded goes in one group
+        int floor; // groups up to this one were (partly) dropped to stay under cap, they can't be undone
+        size_t cap; // most bytes done may take
+} undoHistory;
+
+typedef struct matchIndex{ // every match of the search query in the file, in file order, see Find
+        searchMatch *m;
+        int n, cap;
+        int cur; // the match the cursor is on, -1 if there's none
+        int active; // 1 while the search prompt is open
+        char *query; // the query the matches are for
+        int regex; // 1 if query is a regular expression, toggled with Ctrl-E in the prompt
+        struct regex *re; // query compiled, in regex mode
+        char *error; // why the query isn't a valid regex, NULL if it is
+        int gen; // bumped for every new query, a search started for an older value stops, read & written with __atomic
+        struct searchJob *job; // the search still running, NULL once m holds every match
+        struct searchPiece *pieces; // the text of the file, taken when the prompt opened
+        int npieces;
+        char **copies; // text of the rows in chunks, copied for the pieces
+        int ncopies;
+        int origin_row, origin_cx; // where the cursor was when the prompt opened, the first match shown is the nearest after it
+        int found; // 1 once the match to show first is known
+        int sel_range, sel_i; // which match that is in job, until it finished
+        int shown_row, shown_cx, shown_len; // the match highlighted on screen, drawn over the row's own highlighting by editorDrawRows(). shown_len is 0 if there's none
+} matchIndex;
 
 struct editorConfig{
         int cx, cy; // for moving the cursor around. cx - is horizontal coor(column) index into chars, cy - vertical coor(row)
@@ -98,88 +315,608 @@ struct editorConfig{
         int screenrows;
         int screencols;
         int numrows;
-        erow *row; // array of errow struct, to store multiple line
+        rowNode *rows; // root of the tree holding every row of the file, see Row Storage
+        char *map; // the opened file mapped into memory, lines that were never displayed or edited are read straight from here
+        size_t mapsize;
+        size_t *lineoff; // byte offset in map where each line starts, plus one more entry for the end of the file
+        erow *cache_head, *cache_tail; // rows that have a render & hl, most recently drawn first
+        int cached; // # rows in that list
+        int cachemax; // most rows allowed to keep a render & hl
+        int hl_from, hl_to; // rows whose multi-line comment state may be out of date, see editorSyntaxMark()
+        int hl_known; // rows above this one have their multi-line comment state worked out, see editorSyntaxKnow()
+        unsigned char *hlstate; // the state each line of the mapped file ends in, kept here while the line isn't loaded
+        rowLong **longs; // every row kept in chunks, see Long Rows
+        int nlongs, longcap;
+        matchIndex matches; // matches of the current search, see Find
+        screenCell *frame, *shadow; // the frame being drawn, and what the terminal shows from the frame before
+        int framerows, framecols; // size of both grids, the shadow is thrown away when the size changes
+        int *framelen, *shadowlen; // per row of each grid, cells past this are blank. Keeps clearing & comparing to the part of the rows with text
+        int shadow_valid; // 0 if the terminal may show anything, every cell is sent then
+        int frame_bytes; // bytes written to the terminal for the last frame
+        long frames, frame_bytes_total; // since the editor started
+        int show_stats; // show the stats in the status bar, set by the ONREE_STATS environment variable & toggled with Ctrl-T
+        int headless; // frames are built but not written out, see Benchmarks
+        int outfd; // frames are written here, the terminal or the --replay sink
+        undoHistory undo; // see Undo
+        struct saveJob *save; // the save running in the background, NULL if there's none, see editorSave()
         int dirty; // keep track of whether the text loaded to editor differs from what's in the file. Warn the user they might lose unsaved changes when try to quit, (1) appear, (0) disappea
         char *filename; // for display filename in status bar, save a copy of filename here when a file is opened
         char statusmsg[80]; // display message to the use
-        time_t statusmsg_time; // timestamp for the message display to user, so that can erase it after the message it's been displayed
+        double statusmsg_time; // eventNow() when the message was set, so that can erase it after the message it's been displayed
         struct editorSyntax *syntax;
         struct termios orig_termios;
 };
 
 struct editorConfig E;
 
+unsigned char SEPARATORS[256]; // 1 for chars is_separator() is true for, see editorSyntaxInit()
+
+/* The escape sequence for each foreground color editorSyntaxToColor() returns & the default color 39, so drawing never formats them.
+All of them are 5 bytes */
+const char *SGR_COLOR[] = {
+        [30] = "\x1b[30m", [31] = "\x1b[31m", [32] = "\x1b[32m", [33] = "\x1b[33m", [34] = "\x1b[34m",
+        [35] = "\x1b[35m", [36] = "\x1b[36m", [37] = "\x1b[37m", [39] = "\x1b[39m",
+};
+#define SGR_COLORS (sizeof(SGR_COLOR) / sizeof(SGR_COLOR[0]))
+
+/* What a char is drawn as: itself, or for a control char the printable symbol drawn with inverted colors in its place.
+Ctrl-A = 1, Ctrl-B = 2, …, Ctrl-Z = 26 are the capital letters A through Z and 0 is @. Any other control char is ? */
+unsigned char GLYPH[256];
+unsigned char GLYPH_FLAGS[256]; // CELL_INVERSE for control chars
+
 
 /***** Append Buffer *****/
 struct abuf{
         char *b;
         int len;
+        int cap; // bytes allocated for b, grows by doubling so appending is almost always just a memcpy
+};
+
+#define ABUF_INIT {NULL, 0, 0} // represent an empty buffer b set NUll, len set to 0
+
+struct abuf FRAME = ABUF_INIT; // every frame is built here, kept between frames so its memory is only allocated once
+
+/***** Input Buffer *****/
+/* Keys are taken out of this buffer, which is filled with everything the terminal has sent so far in one read().
+Typing one key is still one read(), but an escape sequence or text pasted in comes in at once instead of a read() per byte */
+struct inputBuffer{
+        char buf[INPUT_BUF_SIZE];
+        int start, end; // the bytes not used yet are buf[start..end)
+        int fd; // the terminal, or the script of keys in --replay
+        int eof; // the script has been read to the end
+};
+
+struct inputBuffer IN = {.fd = STDIN_FILENO};
+
+/***** Event Loop *****/
+/* Keys are applied as soon as they come in but the screen is only drawn once no more input is waiting, at most fps times a second.
+So a burst of keys (key repeat, a fast typist) costs one frame, not one per key. Everything else the editor waits for,
+a resized window or a timer running out, wakes up the same poll() */
+enum eventTimer{
+        TIMER_STATUS, // the status message is too old to show
+        TIMER_IDLE, // no key for ONREE_IDLE_DELAY, do the background work in editorIdle()
+        TIMER_SAVE, // show how far the save is, or that it's done
+        TIMER_COUNT
+};
+
+struct eventLoop{
+        double frame_interval; // 1 / fps
+        double last_frame; // eventNow() when the last frame was drawn
+        double busy_since; // when keys started coming in without a break, a frame is drawn anyway after frame_interval of that
+        int redraw; // something changed since the last frame
+        double timers[TIMER_COUNT]; // eventNow() when each timer runs out, 0 when it's off
+        int wakefd[2]; // pipe written to by the SIGWINCH handler, so poll() wakes up
+        volatile sig_atomic_t resized; // set by the SIGWINCH handler
+};
+
+struct eventLoop EV;
+
+/***** Stats *****/
+/* Timers & counters on the hot paths, always on: a clock_gettime() & a few adds each. Each timer keeps a histogram of how long it took,
+so the status bar can show p50 & p99 (Ctrl-T) and the whole thing can be written to a file at exit, see statDump() */
+enum statTimer{
+        STAT_READKEY, // editorReadKey(), decoding a key once it's there
+        STAT_KEYPRESS, // editorProcessKeypress(), applying a key, without the time waiting for more keys in a prompt
+        STAT_UPDATEROW, // editorUpdateRow()
+        STAT_SYNTAX, // editorUpdateSyntax()
+        STAT_DRAWROWS, // editorDrawRows()
+        STAT_WRITE, // the write() of a frame
+        STAT_FRAME, // editorRefreshScreen(), all of it
+        STAT_LATENCY, // a key coming in to the frame that shows it
+        STAT_COUNT
+};
+
+typedef struct statHist{
+        long n;
+        long total, max; // ns
+        unsigned int bucket[STAT_BUCKETS]; // see statBucket()
+} statHist;
+
+struct editorStats{
+        statHist t[STAT_COUNT];
+        long key_time; // statNow() when the oldest key not on screen yet came in, 0 if there's none
+        long waited; // ns spent in eventWaitInput(), taken off STAT_KEYPRESS
+        long frame_blocks; // row allocator blocks handed out while drawing the last frame
+        int dump; // write the stats to a file at exit
+};
+
+struct editorStats STATS;
+
+/***** Row Allocator *****/
+/* Loaded rows take their memory from here instead of from malloc: the node, chars, render, hl, the tab index. A size is rounded up to a class,
+16 bytes to 4KB in steps of about 1.5x, and blocks are cut one after another out of slabs. A block given back goes on the free list of its class,
+where the next block of that class is taken from. The whole block belongs to the row, chars keeps what it doesn't use as room to grow, so typing
+only allocates when the row outgrows its class. Bigger blocks come from malloc. Closing the file gives every slab back at once */
+const int ROW_CLASS_SIZE[ROW_CLASSES] = {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, ROW_CLASS_MAX};
+
+typedef struct rowSlab{ // the blocks follow
+        struct rowSlab *next;
+} rowSlab;
+
+typedef struct rowBig{ // in front of a block bigger than ROW_CLASS_MAX, they're in a list to be freed when the file is closed
+        struct rowBig *prev, *next;
+} rowBig;
+
+struct rowAllocator{
+        void *free[ROW_CLASSES]; // blocks given back, the first bytes of each one point to the next
+        rowSlab *slabs;
+        char *next, *end; // the part of the newest slab not handed out yet
+        rowBig *big;
+        long blocks; // blocks handed out. This & the 2 below are printed by --bench-rows
+        long mallocs; // calls to mmap & malloc, for slabs & big blocks
+        long grown; // times rowGrow() found the room it was asked for already there
+};
+
+struct rowAllocator ARENA;
+
+/***** Thread Pool *****/
+typedef struct poolTask{
+        void (*fn)(void *arg);
+        void *arg;
+        struct taskGroup *group;
+        struct poolTask *next; // tasks wait in a linked list queue
+} poolTask;
+
+typedef struct taskGroup{
+        int pending; // # tasks submitted and not finished yet, guarded by TP.lock
+} taskGroup;
+
+#define TASKGROUP_INIT {0}
+
+struct threadPool{
+        pthread_mutex_t lock;
+        pthread_cond_t work; // signalled when a task is queued
+        pthread_cond_t done; // signalled when a group's last task finishes
+        poolTask *head, *tail;
+        int nthreads;
+        int started;
 };
 
-#define ABUF_INIT {NULL, 0} // represent an empty buffer b set NUll, len set to 0
+struct threadPool TP = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0};
+
+typedef struct searchPiece{ // text of a loaded row, or of some lines next to each other in the mapped file
+        const char *text;
+        size_t len;
+        int row; // first row of the piece
+        int fileline; // line of the mapped file text starts at, -1 for a loaded row
+} searchPiece;
+
+typedef struct searchRange{ // pieces searched by one task
+        struct searchJob *job;
+        int first, last; // pieces [first, last)
+        searchMatch *m; // matches found, in file order
+        int n, cap;
+        int done; // set by the task when it finished, read & written with __atomic
+} searchRange;
+
+typedef struct searchJob{ // the search for one query, split in ranges run on the thread pool
+        int gen; // the value of E.matches.gen it was started for
+        searchRange *ranges; // in file order
+        int nranges;
+        int start; // the range with the origin, searched first
+        taskGroup group;
+} searchJob;
+
+/* Regular expressions are parsed into a tree, which is compiled to an NFA (Thompson's construction) twice: once as written and once reversed.
+Matching never backtracks, each NFA is run as a DFA built lazily while reading the text, and a line takes time linear in its length, see Regex */
+enum regexASTType{ RA_SET, RA_CAT, RA_ALT, RA_STAR, RA_PLUS, RA_QUEST, RA_BOL, RA_EOL, RA_EMPTY };
+
+typedef struct regexAST{
+        int type;
+        struct regexAST *a, *b; // operands
+        unsigned char set[32]; // RA_SET: the bytes it matches, one bit each
+} regexAST;
+
+enum regexNodeType{ RE_CHAR, RE_SPLIT, RE_BOL, RE_EOL, RE_MATCH };
+
+typedef struct regexNode{ // a node of the NFA
+        int type;
+        int out, out1; // next node, RE_SPLIT goes to both
+        unsigned char set[32]; // RE_CHAR: the bytes it matches
+} regexNode;
+
+typedef struct regex{
+        regexNode *nodes; // both NFAs
+        int n, cap;
+        int start[2]; // entry of the forward and of the reversed NFA
+        int id; // different for every compiled regex, a thread's DFAs are rebuilt when it changes
+} regex;
+
+typedef struct regexDFA{ // a DFA state is the set of NFA nodes the NFA could be in, made the first time it's reached
+        regex *re;
+        int id; // re->id when this was made
+        int reverse; // runs the reversed NFA
+        int unanchored; // a match may begin at any position, not just the first one
+        int nstates;
+        int *next; // 256 transitions per state, -1 until worked out
+        unsigned char *flags; // per state, see REGEX_ACCEPT
+        int *setoff, *setlen; // where each state's NFA nodes are in sets
+        int *sets, setsused, setscap;
+        int *hash; // state index + 1 by set, open addressing, 2 * REGEX_DFA_STATES slots
+        int startstate[2]; // the state at the start, without and with RE_BOL followed, -1 if not made yet
+        int flushes; // bumped by regexFlushDFA(), state numbers from before that are stale
+        int *stack, *mark, *tmp, *seeds, markgen; // scratch for regexClosure()
+} regexDFA;
+
+typedef struct regexSeen{ // a forward scan of regexSearchLine() was at some position in state, see there
+        int state;
+        int last; // the last position from there on where that scan accepted, -1 if none
+        int next; // the next one seen at the same position, -1 at the end
+} regexSeen;
+
+#define REGEX_ACCEPT 1 // the state has reached RE_MATCH
+#define REGEX_ACCEPT_END 2 // the state reaches RE_MATCH if the text ends here
+#define REGEX_END_KNOWN 4 // REGEX_ACCEPT_END has been worked out
+
+typedef struct lineChunk{ // a piece of the file scanned for line endings by one task
+        const char *map;
+        size_t start, end; // byte range of map to scan
+        size_t *starts; // offsets where a line starts, found in this chunk
+        size_t n, cap;
+} lineChunk;
+
+typedef struct hlBlock{ // rows highlighted by one task, see editorSyntaxAll()
+        rowPos start; // the first one, loaded or not
+        int n;
+        int end; // the state the last row ends in, with the first one starting outside a multi-line comment
+} hlBlock;
+
+typedef struct savePiece{ // text to write out, in file order
+        const char *text;
+        size_t len;
+        int mapped; // 1 for lines still in the mapped file, their line endings are made \n while writing. 0 for rows copied with their \n
+        int eof; // 1 if text goes to the end of the mapped file, which gets a \n if it doesn't end in one
+} savePiece;
+
+typedef struct saveJob{ // a save, running on its own thread. Nothing in here is touched by the main thread until done is set
+        char *path; // the file written, symlinks followed
+        mode_t mode; // permissions the file gets
+        savePiece *pieces;
+        int npieces;
+        char **blocks; // the copies of the loaded rows' text
+        int nblocks;
+        size_t total; // bytes of text in pieces
+        size_t consumed; // bytes of pieces written so far, read by the main thread with __atomic for the progress
+        size_t written; // bytes written to the file
+        int dirty; // E.dirty when the save started, if it's still that when the save is done the file holds what the editor does
+        int err; // errno of what went wrong, 0 if nothing
+        int done; // set when the thread is finished, read & written with __atomic
+        pthread_t thread;
+} saveJob;
 
 // Terminal
 void enableRawMode();
 void disableRawMode();
 void die(const char *s);
 int editorReadKey();
+int editorDecodeKey();
+int inputFill(int wait);
+int inputByte(char *c);
+int inputPending();
 int getWindowSize(int *rows, int *cols);
 int getCursorPosition(int *rows, int *cols);
 // Input
 void editorProcessKeypress();
 void editorMoveCursor(int key);
-char *editorPrompt(char *prompt, void(*callback)(char *, int));
+void editorIdle();
+char *editorReadPaste(int *len);
+void editorPaste();
+// Event loop
+void eventInit();
+double eventNow();
+void eventSigwinch(int sig);
+void eventResize();
+void editorRequestRedraw();
+void eventDrawFrame(double now);
+void eventRunTimers(double now);
+int eventTimeout(double now);
+void eventWaitInput();
+char *editorPrompt(char *prompt, void(*callback)(char *, int), int empty_ok);
+// Stats
+long statNow();
+int statBucket(long ns);
+long statBucketValue(int b);
+void statAdd(int timer, long start);
+long statPercentile(int timer, double p);
+void statFrameDone();
+void statWrite(FILE *fp);
+void statDump();
+// Replay
+int editorReplay(int argc, char *argv[]);
+void editorReplayReport();
 // Output 
 void editorRefreshScreen();
-void editorDrawRows(struct abuf *ab);
+void editorDrawRows();
 void editorScroll();
-void editorDrawStatusBar(struct abuf *ab);
+void editorDrawStatusBar();
 void editorSetStatusMessage(const char *fmt, ...);
-void editorDrawMessageBar(struct abuf *ab);
+void editorDrawMessageBar();
+// Screen
+void screenResize();
+screenCell *screenAt(int y, int x);
+int screenPuts(int y, int x, const char *s, int len, int color, int flags);
+int screenCellEq(screenCell *a, screenCell *b);
+int screenBlank(screenCell *c);
+void screenInit();
+void screenSetAttr(struct abuf *ab, int *color, int *flags, screenCell *c);
+void screenMoveCursor(struct abuf *ab, int y, int x);
+void screenFlush(struct abuf *ab);
 // Init
 void initEditor();
+void initEditorSize(int rows, int cols);
 // Append buffer
 void abAppend(struct abuf *ab, const char *s, int len);
+char *abReserve(struct abuf *ab, int len);
+void abReset(struct abuf *ab);
 void abFree(struct abuf *ab);
 // File I/O
 void editorOpen(char *filename);
-char *editorRowsToString(int *buflen);
+void editorMapFile(char *map, size_t size);
+void lineChunkPush(lineChunk *c, size_t off);
+void scanNewlinesScalar(lineChunk *c);
+void scanNewlines(void *arg);
+void editorCloseFile();
 void editorSave();
+saveJob *saveSnapshot();
+void savePush(struct iovec *iov, int *n, const char *s, size_t len, saveJob *job, int fd);
+int saveFlush(struct iovec *iov, int n, saveJob *job, int fd);
+void *saveThread(void *arg);
+int saveFinish(int wait);
+void saveFree(saveJob *job);
+// Thread pool
+void poolStart();
+int poolThreads();
+void poolSubmit(taskGroup *g, void (*fn)(void *), void *arg);
+poolTask *poolTake();
+void poolRun(poolTask *t);
+void *poolWorker(void *arg);
+void poolWait(taskGroup *g);
 //Find
 void editorFind();
 void editorFindCallback(char *query, int key);
+const char *searchScalar(const char *s, size_t n, const char *q, size_t m);
+const char *searchSSE2(const char *s, size_t n, const char *q, size_t m);
+const char *searchAVX2(const char *s, size_t n, const char *q, size_t m);
+const char *searchFind(const char *s, size_t n, const char *q, size_t m);
+void editorFindShow(matchIndex *mi, int row, int cx, int len);
+void editorFindRestore(matchIndex *mi);
+void editorReplace();
+int editorReplaceAll(char *query, char *with);
+void searchRangePush(searchRange *r, int row, int cx, int len);
+void searchSnapshot(matchIndex *mi);
+void searchTask(void *arg);
+void searchStart(matchIndex *mi, char *query);
+void searchCancel(matchIndex *mi);
+int searchPoll(matchIndex *mi);
+void searchLine(searchRange *r, const char *text, int len, int row);
+// Regex
+regexAST *regexNewAST(int type, regexAST *a, regexAST *b);
+void regexFreeAST(regexAST *t);
+regexAST *regexCopyAST(regexAST *t);
+int regexSizeAST(regexAST *t);
+int regexParseClassEscape(char c, unsigned char *set);
+regexAST *regexParseAlt(const char **p, char **err);
+regexAST *regexParseConcat(const char **p, char **err);
+regexAST *regexParseRepeat(const char **p, char **err);
+regexAST *regexParseAtom(const char **p, char **err);
+int regexNewNode(regex *re, int type, int out, int out1);
+int regexCompileAST(regex *re, regexAST *t, int next, int reverse);
+regex *regexCompile(const char *pattern, char **err);
+void regexFree(regex *re);
+regexDFA *regexNewDFA(regex *re, int reverse, int unanchored);
+void regexFreeDFA(regexDFA *d);
+void regexFlushDFA(regexDFA *d);
+void regexClosure(regexDFA *d, int *seeds, int nseeds, int bol);
+int regexIntern(regexDFA *d);
+int regexStart(regexDFA *d, int bol);
+int regexStep(regexDFA *d, int state, unsigned char c);
+int regexAcceptsAtEnd(regexDFA *d, int state);
+regexDFA *regexThreadDFA(regex *re, int reverse);
+void regexSearchLine(regex *re, const char *s, int len, int row, searchRange *r);
+void matchIndexFree(matchIndex *mi);
+// Row allocator
+int rowClass(size_t size);
+void *rowAlloc(size_t size, int *cap);
+void rowFree(void *p, int cap);
+void *rowGrow(void *p, int *cap, int used, size_t size);
+void rowAllocRelease();
+// Row Storage
+rowNode *rowNodeOf(erow *row);
+int rowCount(rowNode *n);
+void rowNodeUpdate(rowNode *n);
+unsigned int rowRandom();
+rowNode *rowNewNode(int fileline, int nlines);
+void rowSplit(rowNode *t, int k, rowNode **l, rowNode **r);
+rowNode *rowMerge(rowNode *a, rowNode *b);
+void rowSetRoot(rowNode *root);
+void rowFreeTree(rowNode *n);
+rowNode *rowFind(int at, int *off);
+int rowNodeIndex(rowNode *n);
+rowNode *rowNodeNext(rowNode *n);
+rowNode *rowNodePrev(rowNode *n);
+rowNode *rowCut(int at);
+char *rowFileLine(int line, int *len);
+void rowInit(erow *row, char *s, size_t len);
+erow *rowLoad(int at);
+erow *editorRowAt(int at);
+erow *editorRowNext(erow *row);
+erow *editorRowPrev(erow *row);
+int editorRowIndex(erow *row);
+void rowPosAt(rowPos *p, int at);
+int rowPosNext(rowPos *p);
+int rowPosPrev(rowPos *p);
+char *rowPosText(rowPos *p, int *len);
 // Row Operation
 void editorInsertRow(int at, char *s, size_t len);
 void editorUpdateRow(erow *row);
+void editorRowDropRender(erow *row);
+erow *editorRowRender(erow *row);
+void editorRowBuildHighlight(erow *row);
+void editorRowDropHighlight(erow *row);
+void editorRowBuildRender(erow *row);
 int editorRowCxToRx(erow *row, int cx);
+int editorRowCxToRxLinear(erow *row, int cx);
 void editorRowInsertChar(erow *row, int at, int c);
 void editorRowDelChar(erow *row, int at);
 void editorFreeRow(erow * row);
 void editorDelRow(int at);
+void editorDelRows(int at, int count);
 void editorRowAppendString(erow *row, char *s, size_t len);
 int editorRowRxToCx(erow *row, int rx);
+int editorRowRxToCxLinear(erow *row, int rx);
+// Tab index
+void rowTabsReset(erow *row);
+void rowTabsBuild(erow *row);
+void rowTabsGrow(erow *row);
+tabStop *rowTabs(erow *row);
+int rowTabsBefore(erow *row, int cx);
+void rowTabsInsert(erow *row, int at, int c);
+void rowTabsDelete(erow *row, int at);
+// Long Rows
+rowLong *rowLongOf(erow *row);
+void rowLongBuild(erow *row, const char *s, int len);
+void rowLongFree(erow *row);
+void rowLongReleaseAll();
+void rowLongReplace(rowLong *lng, int j, int count, const char *s, int len);
+void rowLongUpdate(rowChunk *c);
+int rowLongEndRx(rowChunk *c);
+void rowLongValidate(rowLong *lng, int upto);
+int rowLongFind(rowLong *lng, int cx);
+int rowLongFindRx(rowLong *lng, int rx);
+void rowLongMark(rowLong *lng, int from, int to);
+void rowLongMarkAll();
+void rowLongEdited(rowLong *lng, int j, int m, int off);
+hlState rowLongStart(rowLong *lng, int j);
+void rowLongLex(rowLong *lng, int j, hlState *st, unsigned char *hl);
+int rowLongRelex(rowLong *lng, int start);
+int rowLongCxToRx(rowLong *lng, int cx);
+int rowLongRxToCx(rowLong *lng, int rx);
+int rowLongDraw(erow *row, screenCell *cell);
+void rowInsert(erow *row, int at, const char *s, int len);
+void rowSplice(erow *row, int at, int dellen, const char *s, int len);
+void rowDelete(erow *row, int at, int len);
+void rowCopy(erow *row, int at, int len, char *dst);
 // Editor Operations
 void editorInsertChar(int c);
+void editorInsertText(char *s, int len);
+void editorDeleteText(int at, int col, int len);
+void editorReplaceRow(int at, searchMatch *m, int n, const char *with, int wlen);
+// Undo
+void undoInit();
+undoEntry *undoTop(undoLog *log);
+undoEntry *undoPush(undoLog *log, int type, int group, int row, int col, int cy, int cx, const char *s, int len);
+void undoPop(undoLog *log);
+void undoDropOldest(undoLog *log);
+void undoClear(undoLog *log);
+void undoRecord(int type, int row, int col, const char *s, int len);
+void undoBegin();
+void undoEnd();
+void undoApply(undoEntry *e, int reverse);
+void editorUndo();
+void editorRedo();
 void editorDelChar();
 void editorInsertNewLine();
 // Syntax highlighting
+int editorHighlightLine(char *s, int len, unsigned char *hl, int in_comment);
+void editorHighlightRun(char *s, int len, int stop, unsigned char *hl, hlState *st);
+int editorSyntaxRelex(erow *row);
+int editorRowEndState(erow *row, int in_comment);
+int rowPosEndState(rowPos *p, int in_comment);
+int rowPosState(rowPos *p);
+void rowPosSetState(rowPos *p, int in_comment);
+int rowPosRelex(rowPos *p, int in_comment);
+int editorSyntaxStart(erow *row);
+void editorSyntaxKnow(int at);
+void syntaxBlockTask(void *arg);
+void editorSyntaxAll(int first, int last);
 void editorUpdateSyntax(erow *row);
+void editorSyntaxMark(int at);
+void editorSyntaxShift(int at, int delta);
+int editorSyntaxCatchUp(int until, int budget);
+int editorSyntaxIdle();
 int editorSyntaxToColor(int hl);
 int is_separator(int c);
 void editorSelectSyntaxHighlight();
+void editorSyntaxInit();
+void syntaxCompile(struct editorSyntax *syn);
+// Syntax Files
+void syntaxLoadFiles();
+int syntaxLoadFile(const char *path);
+struct editorSyntax *syntaxAdd(const char *filetype);
+char **syntaxWords(char **list, const char *s, const char *suffix);
+// Keyword table
+unsigned int keywordHash(const char *s, int len, unsigned int seed);
+keywordTable *keywordTableBuild(char **keywords);
+int keywordLookup(keywordTable *t, const char *s, int len);
+int keywordLookupLinear(char **keywords, const char *s, int len);
+// Benchmarks
+double benchNow();
+int editorBenchKeywords(char *filename);
+int editorBenchRender(char *filename);
+int editorBenchTabs();
+long benchRSS();
+int editorBenchRows(char *filename);
+unsigned int benchRand(unsigned int *seed);
+void benchCorpus(const char *kind, const char *path, long bytes);
+void benchResult(const char *bench, long n, double seconds, const char *extra);
+void benchSuiteCorpus(const char *kind, const char *path);
+int editorBenchSuite(int argc, char *argv[]);
 
 
 
 int main(int argc, char *argv[]){
+        if(argc >= 3 && !strcmp(argv[1], "--bench-keywords")){ // compare the keyword matchers on a file, see Benchmarks
+                editorSyntaxInit();
+                return editorBenchKeywords(argv[2]);
+        }
+        if(argc >= 3 && !strcmp(argv[1], "--bench-render")){ // time building frames of a file, see Benchmarks
+                return editorBenchRender(argv[2]);
+        }
+        if(argc >= 2 && !strcmp(argv[1], "--bench-tabs")){ // compare the cx/rx conversions on long TSV lines, see Benchmarks
+                return editorBenchTabs();
+        }
+        if(argc >= 3 && !strcmp(argv[1], "--replay")){ // run a script of keys without a terminal, see Replay
+                return editorReplay(argc, argv);
+        }
+        if(argc >= 2 && !strcmp(argv[1], "--bench-suite")){ // every core operation on generated files, one JSON line per result, see Benchmarks
+                return editorBenchSuite(argc, argv);
+        }
+        if(argc >= 3 && !strcmp(argv[1], "--bench-rows")){ // memory & allocations of loading & editing every row of a file, see Benchmarks
+                return editorBenchRows(argv[2]);
+        }
+
         enableRawMode();
         initEditor();
+        eventInit();
+        atexit(statDump);
         
         if(argc >= 2){
                 editorOpen(argv[1]);
         }
 
-        editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+        if(E.statusmsg[0] == '\0') editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-R = replace"); // unless there's an error in a syntax file to show
 
+        editorRequestRedraw(); // the first frame
         while(1){
                 // char c = '\0';
                 // if(read(STDIN_FILENO, &c, 1) == -1 && errno != EAGAIN) die("read");// read from standard input & store it in c until eof && error is not due to unavaible resource
@@ -191,8 +928,9 @@ int main(int argc, char *argv[]){
                 // }
                 
                 // if(c == CTRL_KEY('q')) break;        
-                editorRefreshScreen(); // ouput
-                editorProcessKeypress(); // input
+                editorProcessKeypress(); // input, the screen is drawn while waiting for the next key, see eventWaitInput()
+                editorScroll(); // the keys after this one may come in before the next frame, PageUp & PageDown need rowoff to follow the cursor already
+                editorRequestRedraw(); // ouput
 
 
         }
@@ -217,9 +955,9 @@ void enableRawMode(){
         raw.c_cflag |= (CS8); // set the char size CS to 8 bits per byte
         raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
 
-        // set timeout for read. Returns if it doesn't get any input 
+        // read never waits, it returns whatever is there. Waiting is done with poll(), see inputFill() & eventWaitInput()
         raw.c_cc[VMIN] = 0;
-        raw.c_cc[VTIME] = 1; // 100 milliseconds
+        raw.c_cc[VTIME] = 0;
 
         /* TCSAFLUSH spefifies when to apply changes(flush - clear & apply new setting right away).
                 - It waits for all pending output to be written to the terminal, 
@@ -227,10 +965,13 @@ void enableRawMode(){
                 - &raw where the new setting being set
         */
         if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr"); 
+
+        write(STDOUT_FILENO, "\x1b[?2004h", 8); // bracketed paste: pasted text comes between <esc>[200~ and <esc>[201~ so it can be told apart from typing
 }
 
 // disable raw mode at exit
 void disableRawMode(){
+        write(STDOUT_FILENO, "\x1b[?2004l", 8); // bracketed paste off again, the shell doesn't expect it
         if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
                 die("tcsetattr");
         }
@@ -283,7 +1024,7 @@ int getCursorPosition(int *rows, int *cols) {
        
         // keep reading until get to to R 
         while (i < sizeof(buf) - 1) {
-                if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+                if (!inputByte(&buf[i])) break;
                 if (buf[i] == 'R') break;
                 i++;
         }
@@ -299,13 +1040,51 @@ int getCursorPosition(int *rows, int *cols) {
 
 
 
-// wait for 1 keypress and returns it. Also handle escape sequence
-int editorReadKey(){
-        int nread;
-        char c;
-        while((nread = read(STDIN_FILENO, &c, 1)) != 1){ // read the 1st char 
-                if(nread == -1 && errno != EAGAIN) die("read");
+/* read whatever the terminal has sent into IN, after the bytes that are still in it. Waits up to wait ms when nothing was sent.
+Returns how many bytes were added, 0 if nothing came in time or IN is full */
+int inputFill(int wait){
+        if(IN.start > 0){ // move the bytes not used yet to the front, to make room after them
+                memmove(IN.buf, &IN.buf[IN.start], IN.end - IN.start);
+                IN.end -= IN.start;
+                IN.start = 0;
         }
+        if(IN.end == INPUT_BUF_SIZE || IN.eof) return 0;
+        struct pollfd pfd = {IN.fd, POLLIN, 0};
+        if(poll(&pfd, 1, wait) <= 0) return 0;
+        int nread = read(IN.fd, &IN.buf[IN.end], INPUT_BUF_SIZE - IN.end);
+        if(nread == -1 && errno != EAGAIN) die("read");
+        if(nread == 0 && IN.fd != STDIN_FILENO) IN.eof = 1; // the end of a --replay script
+        if(nread <= 0) return 0;
+        IN.end += nread;
+        return nread;
+}
+
+// take the next byte of input, reading more if IN is empty. Returns 0 if nothing came within ONREE_KEY_TIMEOUT
+int inputByte(char *c){
+        if(IN.start == IN.end && inputFill(ONREE_KEY_TIMEOUT) == 0) return 0;
+        *c = IN.buf[IN.start++];
+        return 1;
+}
+
+// whether input has been read that isn't used yet
+int inputPending(){
+        return IN.start < IN.end;
+}
+
+// wait for 1 keypress and returns it
+int editorReadKey(){
+        eventWaitInput(); // draw the screen & do background work until there's input
+        long start = statNow();
+        if(STATS.key_time == 0) STATS.key_time = start; // the frame drawn next shows it
+        int c = editorDecodeKey();
+        statAdd(STAT_READKEY, start);
+        return c;
+}
+
+// turn the input into 1 key. Also handle escape sequence
+int editorDecodeKey(){
+        char c = '\0';
+        inputByte(&c); // read the 1st char 
 
         /* In the begining when press on an arrow key it sends bytes as input to the program(turned it off)
         These bytes are in the form: '\x1n', '[', followd by an 'A', 'B', 'C', or 'D' depends on which 4 arrow keys pressed
@@ -314,23 +1093,30 @@ int editorReadKey(){
                 char seq[3];
 
                 // if read an escape char, immediately read 2 more bytes into seq, return escape key if one of these read times out
-                if(read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-                if(read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+                if(!inputByte(&seq[0])) return '\x1b';
+                if(!inputByte(&seq[1])) return '\x1b';
 
                 if(seq[0] == '['){
 
-                        // PAGE_UP & PAGE_DONW keys, in the form <esc>[5~
+                        // PAGE_UP & PAGE_DONW keys, in the form <esc>[5~. The paste markers have 3 digits, <esc>[200~
                         if(seq[1] >= '0' && seq[1] <= '9'){
-                                if(read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b'; // read the tilde into seq[2]
+                                int num = seq[1] - '0';
+                                if(!inputByte(&seq[2])) return '\x1b'; // read the tilde into seq[2]
+                                while(seq[2] >= '0' && seq[2] <= '9' && num < 1000){ // more digits
+                                        num = num * 10 + seq[2] - '0';
+                                        if(!inputByte(&seq[2])) return '\x1b';
+                                }
                                 if(seq[2] == '~'){ // if it is a tilde
-                                        switch(seq[1]){ // test the digit 
-                                                case '1': return HOME_KEY;
-                                                case '3': return DEL_KEY; // not doing anything
-                                                case '4': return END_KEY;
-                                                case '5': return PAGE_UP;
-                                                case '6': return PAGE_DOWN;
-                                                case '7': return HOME_KEY;
-                                                case '8': return END_KEY;
+                                        switch(num){ // test the number 
+                                                case 1: return HOME_KEY;
+                                                case 3: return DEL_KEY; // not doing anything
+                                                case 4: return END_KEY;
+                                                case 5: return PAGE_UP;
+                                                case 6: return PAGE_DOWN;
+                                                case 7: return HOME_KEY;
+                                                case 8: return END_KEY;
+                                                case 200: return PASTE_START;
+                                                case 201: return PASTE_END;
                                         }
                                 }
                         }
@@ -371,12 +1157,14 @@ void editorProcessKeypress(){
         static int quit_times = ONREE_QUIT_TIMES; // keep track of # of times the user must press ctrl-Q to quit
 
         int c = editorReadKey();
+        long start = statNow(), waited = STATS.waited; // a prompt waits for keys in here, that's taken off
         switch(c){
                 case '\r':
                         editorInsertNewLine();
                         break;
 
                 case CTRL_KEY('q'):
+                        saveFinish(1); // a save that's running is finished first, whether the file is dirty depends on how it went
                         if(E.dirty && quit_times > 0){ // each time 
                                 editorSetStatusMessage("WARNING!!! File has unsaved changes. "
                                 "Press Ctrl-Q %d more times to quit", quit_times);
@@ -385,8 +1173,8 @@ void editorProcessKeypress(){
                         }
 
                         // clear the screen on exit, errors will not be printed
-                        write(STDOUT_FILENO, "\x1b[2J", 4);
-                        write(STDOUT_FILENO, "\x1b[H", 3);        
+                        write(E.outfd, "\x1b[2J", 4);
+                        write(E.outfd, "\x1b[H", 3);        
                         exit(0);
                         break;
 
@@ -399,7 +1187,7 @@ void editorProcessKeypress(){
                         break;
                 case END_KEY: 
                         if(E.cy < E.numrows){
-                                E.cx = E.row[E.cy].size; // move the cursor to the end of the current line
+                                E.cx = editorRowAt(E.cy)->size; // move the cursor to the end of the current line
                         }
                         break;
 
@@ -407,6 +1195,22 @@ void editorProcessKeypress(){
                         editorFind();
                         break;
 
+                case CTRL_KEY('r'):
+                        editorReplace();
+                        break;
+
+                case CTRL_KEY('z'):
+                        editorUndo();
+                        break;
+
+                case CTRL_KEY('t'): // show the stats in the status bar, or stop showing them
+                        E.show_stats = !E.show_stats;
+                        STATS.dump |= E.show_stats;
+                        break;
+                case CTRL_KEY('y'):
+                        editorRedo();
+                        break;
+
                 case BACKSPACE:
                 case CTRL_KEY('h'): // sends the control code 8, it's orginally what the backspace char would send back in the day
                 case DEL_KEY:
@@ -439,8 +1243,13 @@ void editorProcessKeypress(){
                         editorMoveCursor(c);
                         break;
 
+                case PASTE_START: // the whole paste goes in at once
+                        editorPaste();
+                        break;
+
                 case CTRL_KEY('l'): // use to refresh the screen after any keypress
                 case '\x1b': // ignore the escape key bc there are many esapce sequeces that arn't handling
+                case PASTE_END:
                         break;
                 
                 // This will allow any keypresses that is not mapped to another editor function to be inserted directly into the text being edited
@@ -450,11 +1259,207 @@ void editorProcessKeypress(){
         }
 
         quit_times = ONREE_QUIT_TIMES; // if the user press any key other than ctrl_Q, quit_times will reset back to 3
+        statAdd(STAT_KEYPRESS, start + (STATS.waited - waited));
+}
+
+/* Read pasted text up to the <esc>[201~ that ends it, after editorReadKey() returned PASTE_START. Returns the text, *len is its length.
+The text is taken out of IN in blocks, with memchr() finding the next escape char */
+char *editorReadPaste(int *len){
+        struct abuf paste = ABUF_INIT;
+        int timeouts = 0;
+        while(timeouts < PASTE_TIMEOUTS){
+                if(IN.start == IN.end && inputFill(ONREE_KEY_TIMEOUT) == 0){
+                        timeouts++;
+                        continue;
+                }
+                timeouts = 0;
+                char *p = &IN.buf[IN.start];
+                int avail = IN.end - IN.start;
+                char *esc = memchr(p, '\x1b', avail);
+                if(esc == NULL){ // all of it is text
+                        abAppend(&paste, p, avail);
+                        IN.start = IN.end;
+                        continue;
+                }
+                abAppend(&paste, p, esc - p);
+                IN.start += esc - p;
+                if(IN.end - IN.start < 6 && inputFill(ONREE_KEY_TIMEOUT) == 0 && IN.end - IN.start < 6){ // the marker might not be all here yet
+                        timeouts++;
+                        continue;
+                }
+                if(IN.end - IN.start >= 6 && memcmp(&IN.buf[IN.start], "\x1b[201~", 6) == 0){
+                        IN.start += 6;
+                        break;
+                }
+                abAppend(&paste, &IN.buf[IN.start++], 1); // an escape char that is part of the text
+        }
+        *len = paste.len;
+        return paste.b;
+}
+
+// insert a paste as one edit: the rows change once, get highlighted once & the screen is drawn once. It's undone in one go too
+void editorPaste(){
+        int len, n = 0;
+        char *text = editorReadPaste(&len);
+        for(int i = 0; i < len; i++){ // terminals send \r for the newlines of a paste, \r\n & \r become \n
+                if(text[i] == '\r'){
+                        text[n++] = '\n';
+                        if(i + 1 < len && text[i + 1] == '\n') i++;
+                }
+                else{
+                        text[n++] = text[i];
+                }
+        }
+        if(n){
+                undoBegin();
+                if(E.cy == E.numrows){
+                        undoRecord(UNDO_ROW_INSERT, E.cy, 0, NULL, 0);
+                        editorInsertRow(E.numrows, "", 0);
+                }
+                undoRecord(UNDO_INSERT, E.cy, E.cx, text, n);
+                editorInsertText(text, n);
+                undoEnd();
+        }
+        free(text);
+}
+
+// work that can wait until the user stops typing
+void editorIdle(){
+        int changed = editorSyntaxIdle(); // rows on screen changed color
+        if(searchPoll(&E.matches)) changed = 1; // more search results came in
+        if(changed) editorRequestRedraw();
+}
+
+/***** Event Loop *****/
+void eventInit(){
+        char *fps = getenv("ONREE_FPS");
+        int n = fps ? atoi(fps) : ONREE_FPS;
+        if(n < 1 || n > 1000) n = ONREE_FPS;
+        EV.frame_interval = 1.0 / n;
+
+        if(pipe(EV.wakefd) == -1) die("pipe");
+        for(int i = 0; i < 2; i++) fcntl(EV.wakefd[i], F_SETFL, O_NONBLOCK); // the handler must never block, neither must emptying it
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = eventSigwinch;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        if(sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+double eventNow(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the window changed size. Only a flag & a byte down the pipe, the rest happens in eventResize()
+void eventSigwinch(int sig){
+        (void)sig;
+        int saved = errno; // write() mustn't change errno for the code the signal interrupted
+        EV.resized = 1;
+        write(EV.wakefd[1], "", 1);
+        errno = saved;
+}
+
+// pick up the new window size, the next frame is drawn from scratch in the new size, see screenResize()
+void eventResize(){
+        EV.resized = 0;
+        int rows, cols;
+        if(getWindowSize(&rows, &cols) == -1) return;
+        E.screenrows = rows - 2; // status bar & message bar
+        E.screencols = cols;
+        E.shadow_valid = 0; // the terminal moved the old text around when it resized
+        editorRequestRedraw();
+}
+
+// the screen has to be drawn again, done by eventWaitInput() when it's time for a frame
+void editorRequestRedraw(){
+        EV.redraw = 1;
+}
+
+void eventDrawFrame(double now){
+        editorRefreshScreen();
+        EV.redraw = 0;
+        EV.last_frame = now;
+}
+
+void eventRunTimers(double now){
+        for(int i = 0; i < TIMER_COUNT; i++){
+                if(EV.timers[i] == 0 || EV.timers[i] > now) continue;
+                EV.timers[i] = 0;
+                switch(i){
+                        case TIMER_STATUS:
+                                editorRequestRedraw(); // to take the message off
+                                break;
+                        case TIMER_SAVE:
+                                if(!saveFinish(0)) EV.timers[i] = now + SAVE_POLL;
+                                break;
+                        case TIMER_IDLE:
+                                editorIdle();
+                                if(E.matches.job || E.hl_from != -1) EV.timers[i] = now + ONREE_IDLE_DELAY; // not done yet, keep checking
+                                break;
+                }
+        }
+}
+
+// ms until the next thing to do with no input coming in: a timer runs out or a frame is due. -1 for nothing
+int eventTimeout(double now){
+        double next = 0;
+        for(int i = 0; i < TIMER_COUNT; i++){
+                if(EV.timers[i] && (next == 0 || EV.timers[i] < next)) next = EV.timers[i];
+        }
+        if(EV.redraw){
+                double frame = EV.last_frame + EV.frame_interval;
+                if(next == 0 || frame < next) next = frame;
+        }
+        if(next == 0) return -1;
+        if(next <= now) return 0;
+        return (int)((next - now) * 1000) + 1; // rounded up, waking up early would only mean going round again
+}
+
+/* Wait until there's input to read, doing everything else the editor waits for meanwhile. The screen is drawn here:
+only when no more input is waiting (all of it is applied first) and at most once every frame_interval.
+While keys keep coming in without a break, a frame still goes out every frame_interval so the screen doesn't freeze */
+void eventWaitInput(){
+        int waited = 0;
+        long start = statNow();
+        while(1){
+                if(EV.resized) eventResize();
+                double now = eventNow();
+                eventRunTimers(now);
+
+                if(inputPending() || inputFill(0)){
+                        if(waited) EV.busy_since = now;
+                        else if(EV.redraw && now - EV.busy_since >= EV.frame_interval && now - EV.last_frame >= EV.frame_interval){
+                                eventDrawFrame(now);
+                                EV.busy_since = now;
+                        }
+                        EV.timers[TIMER_IDLE] = now + ONREE_IDLE_DELAY;
+                        STATS.waited += statNow() - start;
+                        return;
+                }
+
+                if(EV.redraw && now - EV.last_frame >= EV.frame_interval){
+                        eventDrawFrame(now);
+                        continue; // keys may have come in while drawing
+                }
+
+                if(IN.eof) exit(0); // a --replay script is done & its last frame drawn, editorReplayReport() runs at exit
+
+                struct pollfd pfd[2] = {{IN.fd, POLLIN, 0}, {EV.wakefd[0], POLLIN, 0}};
+                if(poll(pfd, 2, eventTimeout(now)) > 0 && (pfd[1].revents & POLLIN)){
+                        char junk[64];
+                        while(read(EV.wakefd[0], junk, sizeof(junk)) > 0); // empty the pipe, EV.resized says what happened
+                }
+                waited = 1;
+        }
 }
 
 void editorMoveCursor(int key){
         /* Check if the cursor is on an actual line, meaning if there's text on that line */
-        erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy]; 
+        erow *row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy); 
 
         switch(key){
                 case ARROW_LEFT: 
@@ -465,7 +1470,7 @@ void editorMoveCursor(int key){
                         }
                         else if(E.cy > 0){ // allow the user to press <- at the begining of the line to move to the end of the previous line
                                 E.cy--;
-                                E.cx = E.row[E.cy].size;
+                                E.cx = editorRowAt(E.cy)->size;
                         }
                         break;
                 case ARROW_RIGHT: // also for horizontal scroll
@@ -494,7 +1499,7 @@ void editorMoveCursor(int key){
         }
 
         // Snap the cursor to end of line(when arrow down, the cursor will be at the end of the next line)
-        row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy]; // if the cursor is past the total # row in a file
+        row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy); // if the cursor is past the total # row in a file
         int rowlen = row ? row->size : 0; // if there's a valid row, get the size of that row
         if(E.cx > rowlen){ // if the col is > rowlen
                 E.cx = rowlen;
@@ -502,8 +1507,9 @@ void editorMoveCursor(int key){
 
 }
 
-/*function that displays a prompt in the status bar, and lets the user input a line of text after the prompt. Also, this function will support (incremental search), meaning the file is searched after each keypress when the user is typing in their search query. This function will take a callback function as an argument. Call this this callback function after each keypress, passing the current search query inputted by the user and the last key they presses */
-char *editorPrompt(char *prompt, void(*callback)(char *, int)){
+/*function that displays a prompt in the status bar, and lets the user input a line of text after the prompt. Also, this function will support (incremental search), meaning the file is searched after each keypress when the user is typing in their search query. This function will take a callback function as an argument. Call this this callback function after each keypress, passing the current search query inputted by the user and the last key they presses.
+Enter is ignored while the input is empty, unless empty_ok is set */
+char *editorPrompt(char *prompt, void(*callback)(char *, int), int empty_ok){
         size_t bufsize = 128;
         char *buf = malloc(bufsize); // buf to store user input
 
@@ -512,7 +1518,7 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)){
 
         while(1){
                 editorSetStatusMessage(prompt, buf); // set the status bar, prompt expects a string %s, which is where the user's input will be displayed
-                editorRefreshScreen(); // refresh the screen
+                editorRequestRedraw(); // refresh the screen once the keys typed so far are in
 
                 int c = editorReadKey();
 
@@ -526,12 +1532,26 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)){
                         return NULL;
                 }
                 else if(c == '\r'){ // when the user press ENTER & their input is not empty. The status bar message is cleared and the input is returned
-                        if(buflen != 0){
+                        if(buflen != 0 || empty_ok){
                                 editorSetStatusMessage("");
                                 if(callback) callback(buf, c);
                                 return buf;
                         }
                 }
+                else if(c == PASTE_START){ // pasted text is added to the input, up to its first line
+                        int len;
+                        char *text = editorReadPaste(&len);
+                        for(int i = 0; i < len && text[i] != '\r' && text[i] != '\n'; i++){
+                                if(iscntrl((unsigned char)text[i]) || (unsigned char)text[i] >= 128) continue;
+                                if(buflen == bufsize - 1){
+                                        bufsize *= 2;
+                                        buf = realloc(buf, bufsize);
+                                }
+                                buf[buflen++] = text[i];
+                        }
+                        buf[buflen] = '\0';
+                        free(text);
+                }
                 else if(!iscntrl(c) && c < 128){ // if the input is a printable chars & isn't a special keys in EditorKey enum, append it to  buf
                         if(buflen == bufsize - 1){ // reallocate size if needed before append to buf
                                 bufsize *= 2;
@@ -547,44 +1567,189 @@ char *editorPrompt(char *prompt, void(*callback)(char *, int)){
 
 
 
+/***** Stats *****/
+long statNow(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* histogram bucket of a time in ns: 0-7 ns get a bucket each, after that each power of 2 is split in 8.
+So a bucket is at most 1/8 wider than the times in it, good enough for a percentile */
+int statBucket(long ns){
+        if(ns < 8) return ns < 0 ? 0 : ns;
+        int b = 63 - __builtin_clzl(ns); // ns is in [2^b, 2^(b+1))
+        int i = (b - 2) * 8 + ((ns >> (b - 3)) & 7);
+        return i < STAT_BUCKETS ? i : STAT_BUCKETS - 1;
+}
+
+// the time in the middle of bucket b
+long statBucketValue(int b){
+        if(b < 8) return b;
+        int shift = b / 8 - 1;
+        return ((8L + b % 8) << shift) + (1L << shift) / 2;
+}
+
+// count the time since start, from statNow()
+void statAdd(int timer, long start){
+        long ns = statNow() - start;
+        statHist *h = &STATS.t[timer];
+        h->n++;
+        h->total += ns;
+        if(ns > h->max) h->max = ns;
+        h->bucket[statBucket(ns)]++;
+}
+
+// the time p of the counted times are at or under, in ns. 0 if nothing was counted
+long statPercentile(int timer, double p){
+        statHist *h = &STATS.t[timer];
+        if(h->n == 0) return 0;
+        long want = (long)(p * h->n), seen = 0;
+        for(int b = 0; b < STAT_BUCKETS; b++){
+                seen += h->bucket[b];
+                if(seen > want) return statBucketValue(b) < h->max ? statBucketValue(b) : h->max;
+        }
+        return h->max;
+}
+
+// a frame went out, it shows every key that came in since the last one
+void statFrameDone(){
+        if(STATS.key_time == 0) return;
+        statAdd(STAT_LATENCY, STATS.key_time);
+        STATS.key_time = 0;
+}
+
+// the timers in a table, the totals, then each timer's histogram as bucket:count pairs for offline analysis
+void statWrite(FILE *fp){
+        static const char *names[STAT_COUNT] = {"readkey", "keypress", "updaterow", "syntax", "drawrows", "write", "frame", "latency"};
+        fprintf(fp, "%-10s %10s %10s %10s %10s %10s   (us)\n", "timer", "count", "mean", "p50", "p99", "max");
+        for(int i = 0; i < STAT_COUNT; i++){
+                statHist *h = &STATS.t[i];
+                fprintf(fp, "%-10s %10ld %10.1f %10.1f %10.1f %10.1f\n", names[i], h->n, h->n ? h->total / 1e3 / h->n : 0.0,
+                        statPercentile(i, 0.5) / 1e3, statPercentile(i, 0.99) / 1e3, h->max / 1e3);
+        }
+        fprintf(fp, "frames %ld, %ld bytes written, %.1f bytes/frame\n", E.frames, E.frame_bytes_total, E.frames ? (double)E.frame_bytes_total / E.frames : 0.0);
+        fprintf(fp, "row allocator: %ld blocks, %ld mallocs, %ld grown in place\n", ARENA.blocks, ARENA.mallocs, ARENA.grown);
+        for(int i = 0; i < STAT_COUNT; i++){
+                fprintf(fp, "hist %s", names[i]);
+                for(int b = 0; b < STAT_BUCKETS; b++){
+                        if(STATS.t[i].bucket[b]) fprintf(fp, " %ld:%u", statBucketValue(b), STATS.t[i].bucket[b]);
+                }
+                fprintf(fp, "\n");
+        }
+}
+
+// at exit, if the stats were shown or ONREE_STATS_FILE is set
+void statDump(){
+        if(!STATS.dump) return;
+        char *path = getenv("ONREE_STATS_FILE");
+        FILE *fp = fopen(path ? path : ONREE_STATS_FILE, "w");
+        if(fp == NULL) return;
+        statWrite(fp);
+        fclose(fp);
+}
+
+
+/***** Replay *****/
+/* ./hello --replay SCRIPT [--size ROWSxCOLS] [--out FILE] [FILE]
+Runs the editor without a terminal: keys are read from SCRIPT, the bytes a terminal would send (escape sequences & all), and frames are written
+to FILE (/dev/null by default) for a screen of ROWSxCOLS (24x80). Each key goes through editorProcessKeypress() & gets its own frame from
+editorRefreshScreen(), like someone typing slower than the frame rate. When the script runs out, how long the keys took is printed */
+int editorReplay(int argc, char *argv[]){
+        char *out = "/dev/null", *filename = NULL;
+        int rows = 24, cols = 80;
+        for(int i = 3; i < argc; i++){
+                if(!strcmp(argv[i], "--size") && i + 1 < argc){
+                        if(sscanf(argv[++i], "%dx%d", &rows, &cols) != 2 || rows < 3 || cols < 1){
+                                fprintf(stderr, "--size wants ROWSxCOLS, like 24x80\n");
+                                return 1;
+                        }
+                }
+                else if(!strcmp(argv[i], "--out") && i + 1 < argc) out = argv[++i];
+                else filename = argv[i];
+        }
+
+        IN.fd = open(argv[2], O_RDONLY);
+        if(IN.fd == -1){
+                perror(argv[2]);
+                return 1;
+        }
+        initEditorSize(rows, cols);
+        E.outfd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(E.outfd == -1){
+                perror(out);
+                return 1;
+        }
+        eventInit();
+        EV.frame_interval = 0; // a frame after every key
+        if(filename) editorOpen(filename);
+        atexit(statDump);
+        atexit(editorReplayReport);
+
+        editorRequestRedraw(); // the first frame
+        while(1){ // the same as main(), eventWaitInput() exits when the script is done
+                editorProcessKeypress();
+                editorScroll();
+                editorRequestRedraw();
+        }
+}
+
+void editorReplayReport(){
+        saveFinish(1); // a save the script started
+        statHist *key = &STATS.t[STAT_LATENCY];
+        printf("replay: %ld keys, %.1f ms from key in to frame out, %ld frames, %ld bytes written\n",
+                STATS.t[STAT_READKEY].n, key->total / 1e6, E.frames, E.frame_bytes_total);
+        printf("per key: mean %.1f  p50 %.1f  p99 %.1f  max %.1f us\n", key->n ? key->total / 1e3 / key->n : 0.0,
+                statPercentile(STAT_LATENCY, 0.5) / 1e3, statPercentile(STAT_LATENCY, 0.99) / 1e3, key->max / 1e3);
+        statWrite(stdout);
+}
+
+
 /***** Output *****/
 void editorRefreshScreen(){
+        long start = statNow(), blocks = ARENA.blocks;
         editorScroll();
-
-        struct abuf ab = ABUF_INIT;
-        /* write 4 bytes out the terminal. 1st byte is \x1b(escape char-27), 3 bytes is [2J
-                J - erase in display. 2 is the argu. means to clear the entire screen
-        */
-        abAppend(&ab, "\x1b[?25l", 6); // set mode - hide cursor before refreshing the screen
-        // abAppend(&ab, "\x1b[2J", 4); // instead of clear the entire screen, let's clear each line as draw. See editorDrawrows()
-        abAppend(&ab, "\x1b[H", 3); // 3 bytes long. H command to position the cursor, default para is 1 (<esc>[1;1H), 1 row 1 col
-
-        editorDrawRows(&ab);
-        editorDrawStatusBar(&ab);
-        editorDrawMessageBar(&ab);
+        editorSyntaxCatchUp(E.rowoff + E.screenrows, ONREE_HL_BUDGET); // bring the highlighting of the visible rows up to date first
+
+        screenResize();
+        long t = statNow();
+        editorDrawRows();
+        statAdd(STAT_DRAWROWS, t);
+        editorDrawStatusBar();
+        editorDrawMessageBar();
+
+        struct abuf *ab = &FRAME;
+        abReset(ab);
+        screenFlush(ab); // only what changed since the last frame
         
         // This is to move the cursor to the position store in E.cx & E.cy
-        char buf[32];
         /* [ - to start the escape sequence. H - cmd to move the cursor to specific position
         Format a str & store into buf, also convert 0-indexed to 1 that the terminal uses 
         substract E.coloff to fix the cursor position, before isn't position properly(it does not want to go back when pressed)*/
-        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1); 
-        abAppend(&ab, buf, strlen(buf));
-
-        abAppend(&ab, "\x1b[?25h", 6); // reset mode - show the cursor again after the refresh finishes 
-
-        write(STDOUT_FILENO, ab.b, ab.len); // write buffer content all at once out to standard output
-        abFree(&ab);
+        screenMoveCursor(ab, E.cy - E.rowoff, E.rx - E.coloff);
+
+        abAppend(ab, "\x1b[?25h", 6); // reset mode - show the cursor again after the refresh finishes 
+
+        t = statNow();
+        if(!E.headless) write(E.outfd, ab->b, ab->len); // write buffer content all at once out to standard output
+        statAdd(STAT_WRITE, t);
+        E.frame_bytes = ab->len;
+        E.frames++;
+        E.frame_bytes_total += ab->len;
+        STATS.frame_blocks = ARENA.blocks - blocks;
+        statAdd(STAT_FRAME, start);
+        statFrameDone();
 }
 
 
 
 // print the correct number of tildes for the height of the terminal
-void editorDrawRows(struct abuf *ab){
+void editorDrawRows(){
         int y;
+        erow *row = (E.rowoff < E.numrows) ? editorRowAt(E.rowoff) : NULL; // look up the first visible row once, then walk to its neighbours
         // screenrow is set by initEditor() when getWindowSize() is called
         for (y = 0; y < E.screenrows; y++){
-                int filerow = y + E.rowoff; // to get the # row of the file at each y position, also use this as an index into E.row
+                int filerow = y + E.rowoff; // to get the # row of the file at each y position, also use this to know when the rows run out
                 if(filerow >= E.numrows){ // beyond the text that needs to be displayed
                         /* Only display welcome message when the program start with no argus.
                         not when a user open a file*/
@@ -596,71 +1761,58 @@ void editorDrawRows(struct abuf *ab){
                                 /*Center the welcome message. Divide the screen by 2 then subtract half of the string's length from that
                                 Basically how far from the left edge of the screen it should be printing*/
                                 int padding = (E.screencols - welcomelen) / 2;
-                                if(padding){ // if there is any padding 
-                                        abAppend(ab, "~", 1); // append tilde first 
-                                        padding--;
-                                }
-                                // use the padding-- above for this one. Continue to execute as long as padding is != 0. Decrement by 1 each time. postfux dec. current value of padding is used first
-                                while(padding--) abAppend(ab, " ", 1);
-                                
-                                abAppend(ab, welcome, welcomelen);
+                                if(padding) screenPuts(y, 0, "~", 1, 39, 0); // tilde first, the rest of the padding is already blank
+                                screenPuts(y, padding, welcome, welcomelen, 39, 0);
                         }
                         else{
-                                abAppend(ab, "~", 1); // else append tildes to the 1st col of each row
+                                screenPuts(y, 0, "~", 1, 39, 0); // else put tildes in the 1st col of each row
                         }
                
                 }
                 else{ // this is for displaying a row of text 
-                        int len = E.row[filerow].rsize - E.coloff; // get the length of the current row
-                        if(len < 0) len = 0; // if the user scroll hori. past the end of the file, set len to 0 so nothing is displayed
-                        if(len > E.screencols) len = E.screencols; // if the text is longer than the screen width, truncate it
+                        screenCell *cell = screenAt(y, 0);
+                        int len, j;
+                        if(row->longrow){ // only the chunks under the screen are looked at, see Long Rows
+                                len = rowLongDraw(row, cell);
+                        }
+                        else{
+                                editorRowRender(row); // build render & hl if the row doesn't have them
+                                len = row->rsize - E.coloff; // get the length of the current row
+                                if(len < 0) len = 0; // if the user scroll hori. past the end of the file, set len to 0 so nothing is displayed
+                                if(len > E.screencols) len = E.screencols; // if the text is longer than the screen width, truncate it
                        
-                        unsigned char *hl = &E.row[filerow].hl[E.coloff];
-                        int current_color = -1;
-
-                        char *c = &E.row[filerow].render[E.coloff];
-                        int j;
-                        for(j = 0; j < len; j++){
-
-                                if(iscntrl(c[j])){
-                                        char sym = (c[j] <= 26) ? '@' + c[j] : '?'; // translate to printable char by adding @, letters of the alphabet comes after the @ char
-                                        abAppend(ab, "\x1b[7m", 4); // switch to inverted color before printing the translated symbol
-                                        abAppend(ab, &sym, 1);
-                                        abAppend(ab, "\x1b[m", 3); // turn off inverted colors. This will turn off all text formatting including colors
-                                        if(current_color != -1){ // print the escape sequence for the current color
-                                                char buf[16];
-                                                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                                                abAppend(ab, buf, clen);
-                                        }
-                                }
-                                else if(hl[j] == HL_NORMAL){
-                                        if(current_color != -1){
-                                                abAppend(ab, "\x1b[39m", 5); // set color back to normal before printing
-                                                current_color = -1; // -1 default text color
+                                char *c = &row->render[E.coloff];
+                                int k = 0, pos = 0; // the highlight run & the render index it starts at
+                                while(k < row->nhl && pos + row->hl[k].len <= E.coloff) pos += row->hl[k++].len; // runs left of the screen
+                                j = 0;
+                                while(j < len){
+                                        int end = len, color = 39; // past the last run the chars are HL_NORMAL
+                                        if(k < row->nhl){ // the chars of a run share the color
+                                                pos += row->hl[k].len;
+                                                end = pos - E.coloff < len ? pos - E.coloff : len;
+                                                if(row->hl[k].hl != HL_NORMAL) color = editorSyntaxToColor(row->hl[k].hl);
+                                                k++;
                                         }
-                                       
-                                        abAppend(ab, &c[j], 1); // append the current digit to the buffer
-                                }
-                                else{
-                                        int color = editorSyntaxToColor(hl[j]);
-                                        if(color != current_color){ 
-                                                // when the color changes, print out the escape sequence for that color adn set to new color
-                                                current_color = color;
-                                                char buf[16];
-                                                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                                                abAppend(ab, buf, clen);
+                                        for(; j < end; j++){ // control chars become their symbol through the tables, no branch per char
+                                                unsigned char ch = c[j];
+                                                cell[j].ch = GLYPH[ch];
+                                                cell[j].color = color;
+                                                cell[j].flags = GLYPH_FLAGS[ch];
                                         }
-                                        
-                                        abAppend(ab, &c[j], 1);
                                 }
                         }
-                        abAppend(ab, "\x1b[39m", 5); // after done looping all the chars, reset the text color to default
+                        matchIndex *mi = &E.matches;
+                        if(mi->shown_len && filerow == mi->shown_row){ // the match the cursor is on, in the search prompt
+                                int cx = mi->shown_cx < row->size ? mi->shown_cx : row->size;
+                                int cxend = cx + mi->shown_len < row->size ? cx + mi->shown_len : row->size;
+                                int from = editorRowCxToRx(row, cx) - E.coloff, to = editorRowCxToRx(row, cxend) - E.coloff; // tabs in the match are wider once rendered
+                                if(from < 0) from = 0;
+                                if(to > len) to = len;
+                                for(j = from; j < to; j++) cell[j].color = editorSyntaxToColor(HL_MATCH);
+                        }
+                        E.framelen[y] = len;
+                        row = editorRowNext(row);
                 }
-                
-                /* k - erase in line, erases part of the current line to the right of the cursor. 0 is default param. so it's just <esc>[K */ 
-                abAppend(ab, "\x1b[K", 3); 
-                abAppend(ab, "\r\n", 2); // print a new line after the last row it draws
-
         }
 }
 
@@ -671,7 +1823,7 @@ void editorScroll(){
         E.rx = E.cx; 
 
         if(E.cy < E.numrows){
-                E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+                E.rx = editorRowCxToRx(editorRowAt(E.cy), E.cx);
         }
 
         // rowoff is always at the top, == 0
@@ -690,12 +1842,10 @@ void editorScroll(){
 }
 
 
-void editorDrawStatusBar(struct abuf *ab){
-        /* m command is to select graphic rendition, 1(bold), 4(underscore)
-        5(blink), 7 (for inverted color) */
-        abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar(){
+        // the whole line has inverted colors
         
-        char status[80], rstatus[80];
+        char status[160], rstatus[80];
         // write eveything to status buffer. 
         int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
                 E.filename ? E.filename : "[No Name]", E.numrows,
@@ -704,22 +1854,39 @@ void editorDrawStatusBar(struct abuf *ab){
         keep printing spaces until get to the point where if we printed the second status string, it would end up against the right edge of the screen. */
         int rlen = snprintf(rstatus, sizeof(rstatus), "File Type: %s | %d/%d",
         E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
+        char *mode = E.matches.regex ? "regex " : "";
+        if(E.matches.active && E.matches.error){ // the regex doesn't compile yet
+                rlen = snprintf(rstatus, sizeof(rstatus), "regex: %s | %d/%d", E.matches.error, E.cy + 1, E.numrows);
+        }
+        else if(E.matches.job){ // still searching, the count goes up as parts of the file are done
+                rlen = snprintf(rstatus, sizeof(rstatus), "%s%d matches... | File Type: %s | %d/%d",
+                mode, E.matches.n, E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
+        }
+        else if(E.matches.active){ // while searching, show which match the cursor is on and how many there are
+                rlen = snprintf(rstatus, sizeof(rstatus), "%s%d/%d matches | File Type: %s | %d/%d",
+                mode, E.matches.cur + 1, E.matches.n, E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
+        }
+
+        if(E.show_stats && len < (int)sizeof(status)){ // p50/p99 in us, the last frame's bytes & row allocations
+                len += snprintf(status + len, sizeof(status) - len, " | p50/p99 key %ld/%ld frame %ld/%ldus | %dB %ld allocs",
+                        statPercentile(STAT_LATENCY, 0.5) / 1000, statPercentile(STAT_LATENCY, 0.99) / 1000,
+                        statPercentile(STAT_FRAME, 0.5) / 1000, statPercentile(STAT_FRAME, 0.99) / 1000, E.frame_bytes, STATS.frame_blocks);
+        }
+        if(len > (int)sizeof(status) - 1) len = sizeof(status) - 1;
 
+        int y = E.screenrows;
         if(len > E.screencols) len = E.screencols;
-        abAppend(ab, status, len);
+        screenPuts(y, 0, status, len, 39, CELL_INVERSE);
 
         while (len < E.screencols) {
                 if(E.screencols - len == rlen){
-                        abAppend(ab, rstatus, rlen); // print status str & break out of loop
+                        screenPuts(y, len, rstatus, rlen, 39, CELL_INVERSE); // print status str & break out of loop
                         break;
                 }
                 else{
-                        abAppend(ab, " ", 1); // else keep adding space until == rlen
-                        len++;
+                        len = screenPuts(y, len, " ", 1, 39, CELL_INVERSE); // else keep adding space until == rlen
                 }
         }
-        abAppend(ab, "\x1b[m", 3); // <esc>[m to go back to normal text formatting.
-        abAppend(ab, "\r\n" , 2); // a new line after the staus bar line
 }
 
 
@@ -728,37 +1895,245 @@ void editorSetStatusMessage(const char *fmt, ...){
         va_start(ap, fmt); // initilizes ap variable and get additional agu after fmt
         vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap); // works like snprintf, ap contain additional argu
         va_end(ap);
-        E.statusmsg_time = time(NULL); // returns the number of seconds that have passed since midnight, January 1, 1970 as an integer
+        E.statusmsg_time = eventNow();
+        EV.timers[TIMER_STATUS] = E.statusmsg_time + ONREE_STATUS_SECONDS; // a frame goes out when it runs out, to take the message off
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-        abAppend(ab, "\x1b[K", 3); // first clear any message before displaying new one
+void editorDrawMessageBar() {
         int msglen = strlen(E.statusmsg);
         if (msglen > E.screencols) msglen = E.screencols; // make sure the message will fit the screen
-        // message will disappear when press a key after 5 seconds
-        if (msglen && time(NULL) - E.statusmsg_time < 5) // time(null) will always changes as time progress, E.staustime_mgs will remains constant once it's set
-                abAppend(ab, E.statusmsg, msglen); // display the message iff' the message is < 5 seconds old
+        // message will disappear after 5 seconds, TIMER_STATUS draws a frame then
+        if (msglen && eventNow() - E.statusmsg_time < ONREE_STATUS_SECONDS) // eventNow() will always changes as time progress, E.staustime_mgs will remains constant once it's set
+                screenPuts(E.screenrows + 1, 0, E.statusmsg, msglen, 39, 0); // display the message iff' the message is < 5 seconds old
+}
+
+
+/***** Screen *****/
+// make the grids fit the window and clear the frame to blanks, the shadow is dropped if the size changed
+void screenResize(){
+        int rows = E.screenrows + 2, cols = E.screencols; // + status bar & message bar
+        screenCell blank = {' ', 39, 0};
+        if(rows != E.framerows || cols != E.framecols){
+                free(E.frame);
+                free(E.shadow);
+                free(E.framelen);
+                free(E.shadowlen);
+                E.frame = malloc(rows * cols * sizeof(screenCell));
+                E.shadow = malloc(rows * cols * sizeof(screenCell));
+                E.framelen = malloc(rows * sizeof(int));
+                E.shadowlen = malloc(rows * sizeof(int));
+                E.framerows = rows;
+                E.framecols = cols;
+                E.shadow_valid = 0;
+                for(int i = 0; i < rows * cols; i++) E.frame[i] = E.shadow[i] = blank;
+                for(int y = 0; y < rows; y++) E.framelen[y] = E.shadowlen[y] = 0;
+        }
+        for(int y = 0; y < rows; y++){ // only the part of each row the frame before last drew on isn't blank
+                screenCell *c = &E.frame[y * cols];
+                for(int x = 0; x < E.framelen[y]; x++) c[x] = blank;
+                E.framelen[y] = 0;
+        }
+}
+
+screenCell *screenAt(int y, int x){
+        return &E.frame[y * E.framecols + x];
+}
+
+// put len chars at row y from col x, cut at the right edge. Returns the col after the last one
+int screenPuts(int y, int x, const char *s, int len, int color, int flags){
+        screenCell *c = screenAt(y, 0);
+        for(int i = 0; i < len && x < E.framecols; i++, x++){
+                c[x].ch = s[i];
+                c[x].color = color;
+                c[x].flags = flags;
+        }
+        if(x > E.framelen[y]) E.framelen[y] = x;
+        return x;
+}
+
+int screenCellEq(screenCell *a, screenCell *b){
+        return a->ch == b->ch && a->color == b->color && a->flags == b->flags;
+}
+
+int screenBlank(screenCell *c){
+        return c->ch == ' ' && c->color == 39 && c->flags == 0;
+}
+
+// fill the GLYPH tables, once at startup
+void screenInit(){
+        for(int c = 0; c < 256; c++){
+                GLYPH[c] = c;
+                GLYPH_FLAGS[c] = 0;
+                if(c < 32 || c == 127){
+                        GLYPH[c] = c <= 26 ? '@' + c : '?'; // translate to printable char by adding @, letters of the alphabet comes after the @ char
+                        GLYPH_FLAGS[c] = CELL_INVERSE;
+                }
+        }
+}
+
+// append the SGR codes that take the terminal from color & flags to what c needs
+void screenSetAttr(struct abuf *ab, int *color, int *flags, screenCell *c){
+        if(*flags != c->flags){
+                abAppend(ab, "\x1b[m", 3); // turn off all formatting, colors included
+                *color = 39;
+                *flags = 0;
+                if(c->flags & CELL_INVERSE) abAppend(ab, "\x1b[7m", 4);
+                *flags = c->flags;
+        }
+        if(*color != c->color){
+                if(c->color < SGR_COLORS && SGR_COLOR[c->color]) abAppend(ab, SGR_COLOR[c->color], 5);
+                else{ // not in the table, never happens with the colors editorSyntaxToColor() has
+                        char buf[16];
+                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", c->color);
+                        abAppend(ab, buf, clen);
+                }
+                *color = c->color;
+        }
+}
+
+// <esc>[y;xH, 1-based, with the numbers written by hand instead of with snprintf
+void screenMoveCursor(struct abuf *ab, int y, int x){
+        char *p = abReserve(ab, 32), *start = p;
+        if(p == NULL) return;
+        int v[2] = {y + 1, x + 1};
+        *p++ = '\x1b';
+        *p++ = '[';
+        for(int i = 0; i < 2; i++){
+                char digits[12];
+                int n = 0, d = v[i];
+                do{
+                        digits[n++] = '0' + d % 10;
+                        d /= 10;
+                } while(d);
+                while(n) *p++ = digits[--n];
+                *p++ = i == 0 ? ';' : 'H';
+        }
+        ab->len += p - start;
+}
+
+/* Send the cells of E.frame that differ from E.shadow. For each row the changed spans are found, spans less than SCREEN_GAP apart are joined,
+and each span is one cursor move & its chars. When the rest of a row is blank, <esc>[K clears it instead of sending spaces.
+A row with bytes above 127 (UTF-8) is sent whole when it changes, a span could start in the middle of a char. The shadow becomes the frame */
+void screenFlush(struct abuf *ab){
+        int color = 39, flags = 0; // what the terminal is set to, every frame ends with the default
+        int cols = E.framecols, hidden = 0;
+        for(int y = 0; y < E.framerows; y++){
+                screenCell *now = &E.frame[y * cols], *was = &E.shadow[y * cols];
+                int blank = E.framelen[y]; // the row is blank from here to the end
+                while(blank > 0 && screenBlank(&now[blank - 1])) blank--;
+                int n = E.framelen[y] > E.shadowlen[y] ? E.framelen[y] : E.shadowlen[y]; // both rows are blank past n, nothing changed there
+                if(!E.shadow_valid) n = cols;
+                else if(!memcmp(now, was, n * sizeof(screenCell))) continue; // most rows don't change, memcmp() finds out fastest
+                int wide = 0;
+                for(int x = 0; x < n && E.shadow_valid; x++) if(now[x].ch > 127 || was[x].ch > 127) wide = 1;
+
+                int x = 0;
+                while(x < n){
+                        if(E.shadow_valid && !wide){
+                                while(x < n && screenCellEq(&now[x], &was[x])) x++; // skip what didn't change
+                                if(x == n) break;
+                        }
+                        int end = x + 1; // one past the last changed cell of the span
+                        if(!E.shadow_valid || wide) end = n;
+                        else{
+                                for(int same = 0, i = end; i < n && same < SCREEN_GAP; i++){
+                                        if(screenCellEq(&now[i], &was[i])) same++;
+                                        else{
+                                                same = 0;
+                                                end = i + 1;
+                                        }
+                                }
+                        }
+
+                        if(!hidden){
+                                abAppend(ab, "\x1b[?25l", 6); // hide cursor while drawing
+                                hidden = 1;
+                        }
+                        screenMoveCursor(ab, y, x);
+                        int stop = end < blank ? end : blank;
+                        while(x < stop){
+                                screenSetAttr(ab, &color, &flags, &now[x]);
+                                int run = x + 1; // cells with the same color go out in one copy
+                                while(run < stop && now[run].color == now[x].color && now[run].flags == now[x].flags) run++;
+                                char *p = abReserve(ab, run - x);
+                                if(p == NULL) break;
+                                for(int i = x; i < run; i++) *p++ = now[i].ch;
+                                ab->len += run - x;
+                                x = run;
+                        }
+                        if(end > blank){ // the span runs into the blank end of the row
+                                screenCell def = {' ', 39, 0};
+                                screenSetAttr(ab, &color, &flags, &def);
+                                abAppend(ab, "\x1b[K", 3); // erase to the end of the line
+                                break;
+                        }
+                        x = end;
+                }
+        }
+        screenCell def = {' ', 39, 0};
+        screenSetAttr(ab, &color, &flags, &def);
+
+        screenCell *t = E.shadow; // the frame is what the terminal shows now
+        E.shadow = E.frame;
+        E.frame = t;
+        int *tlen = E.shadowlen;
+        E.shadowlen = E.framelen;
+        E.framelen = tlen;
+        E.shadow_valid = 1;
 }
 
 
 
 // Init
 void initEditor(){
+        int rows, cols;
+        // update screenrows & screencols
+        if(getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+        initEditorSize(rows, cols);
+}
+
+// set up the editor for a window of rows x cols without asking the terminal, benchmarks call this directly
+void initEditorSize(int rows, int cols){
         E.cx = 0, E.cy = 0; // cursor start from the top left of the screen
         E.rx = 0;
         E.rowoff = 0; // default scroll to the top of the file by default
         E.coloff = 0; 
         E.numrows = 0;
-        E.row = NULL; // initialized ptr to NULL
+        E.rows = NULL; // initialized ptr to NULL, an empty tree
+        E.map = NULL; // nothing is mapped until a file is opened
+        E.mapsize = 0;
+        E.lineoff = NULL;
+        E.hlstate = NULL;
+        E.cache_head = E.cache_tail = NULL;
+        E.cached = 0;
         E.dirty = 0;
         E.filename = NULL; // stay NULL if a file isn't opened (which what happend when this program run w/o argus.)
         E.statusmsg[0] = '\0'; // no message will be displayed by default
         E.statusmsg_time = 0; // timestamp when set the message
         E.syntax = NULL; // NULL means there's no filetype for the current file and no highlight should be done
         
-        // update screenrows & screencols
-        if(getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+        E.screenrows = rows;
+        E.screencols = cols;
         E.screenrows -= 2; // so that editorDrawRows() doesn’t try to draw a line of text at the bottom of the screen.
+        E.hl_from = E.hl_to = -1; // no rows waiting to have their highlighting redone
+        E.hl_known = 0;
+        E.save = NULL;
+        undoInit();
+        matchIndexFree(&E.matches); // no search yet
+        E.frame = E.shadow = NULL; // made by the first editorRefreshScreen()
+        E.framelen = E.shadowlen = NULL;
+        E.framerows = E.framecols = 0;
+        E.shadow_valid = 0;
+        E.frame_bytes = 0;
+        E.frames = E.frame_bytes_total = 0;
+        E.show_stats = getenv("ONREE_STATS") != NULL;
+        E.headless = 0;
+        E.outfd = STDOUT_FILENO;
+        STATS.dump = E.show_stats || getenv("ONREE_STATS_FILE");
+        screenInit();
+        editorSyntaxInit();
+        E.cachemax = ONREE_RENDER_CACHE;
+        if(E.cachemax < E.screenrows * 2) E.cachemax = E.screenrows * 2; // always room for every row on the screen
 }
 
 
@@ -768,17 +2143,121 @@ void initEditor(){
         - replace all write() with code that appends str to a buf & then write this buf out at the end
 */
 void abAppend(struct abuf *ab, const char *s, int len) {
-        // ab->b is the str to be reallocated(new size). ask realloc to give a block of memory of the current str + the size of str appending
-        char *new = realloc(ab->b, ab->len + len); 
-        
-        if (new == NULL) return;
-        memcpy(&new[ab->len], s, len); // copy content of s to new
-        // update the struct
-        ab->b = new;
+        char *p = abReserve(ab, len);
+        if (p == NULL) return;
+        memcpy(p, s, len); // copy content of s to the end of the buffer
         ab->len += len;
 }
+
+/* make room for len more bytes & return where they go, the caller writes them and adds len to ab->len.
+Lets a run of chars be copied straight into the buffer. The buffer at least doubles when it grows, so it's rarely reallocated */
+char *abReserve(struct abuf *ab, int len) {
+        if(ab->len + len > ab->cap){
+                int cap = ab->cap ? ab->cap * 2 : 4096;
+                while(cap < ab->len + len) cap *= 2;
+                char *new = realloc(ab->b, cap);
+                if (new == NULL) return NULL;
+                ab->b = new;
+                ab->cap = cap;
+        }
+        return &ab->b[ab->len];
+}
+
+// empty the buffer but keep its memory for the next frame
+void abReset(struct abuf *ab) {
+        ab->len = 0;
+}
+
 void abFree(struct abuf *ab) {
         free(ab->b); // free mem for allocated st
+        ab->b = NULL;
+        ab->len = ab->cap = 0;
+}
+
+
+/***** Thread Pool *****/
+/* Worker threads, one per CPU, started the first time a task is submitted. Tasks are put into a group
+so whoever submitted them can wait for all of them with poolWait(). While waiting, the caller runs queued tasks itself */
+void poolStart(){
+        int n = sysconf(_SC_NPROCESSORS_ONLN);
+        if(n < 1) n = 1;
+        if(n > POOL_MAX_THREADS) n = POOL_MAX_THREADS;
+        for(int i = 0; i < n; i++){
+                pthread_t t;
+                if(pthread_create(&t, NULL, poolWorker, NULL) != 0) break;
+                pthread_detach(t); // workers run until the program exits
+                TP.nthreads++;
+        }
+}
+
+// # of threads that can run tasks at once, the caller of poolWait() included
+int poolThreads(){
+        pthread_mutex_lock(&TP.lock);
+        if(!TP.started){
+                TP.started = 1;
+                poolStart();
+        }
+        int n = TP.nthreads + 1;
+        pthread_mutex_unlock(&TP.lock);
+        return n;
+}
+
+void poolSubmit(taskGroup *g, void (*fn)(void *), void *arg){
+        poolThreads(); // make sure the workers are running
+        poolTask *t = malloc(sizeof(poolTask));
+        t->fn = fn;
+        t->arg = arg;
+        t->group = g;
+        t->next = NULL;
+
+        pthread_mutex_lock(&TP.lock);
+        if(g) g->pending++;
+        if(TP.tail) TP.tail->next = t; // add to the end of the queue
+        else TP.head = t;
+        TP.tail = t;
+        pthread_cond_signal(&TP.work);
+        pthread_mutex_unlock(&TP.lock);
+}
+
+// take the first task off the queue, the pool lock must be held
+poolTask *poolTake(){
+        poolTask *t = TP.head;
+        if(t){
+                TP.head = t->next;
+                if(TP.head == NULL) TP.tail = NULL;
+        }
+        return t;
+}
+
+// run a task without holding the lock, then mark it done in its group
+void poolRun(poolTask *t){
+        pthread_mutex_unlock(&TP.lock);
+        t->fn(t->arg);
+        pthread_mutex_lock(&TP.lock);
+        if(t->group && --t->group->pending == 0) pthread_cond_broadcast(&TP.done);
+        free(t);
+}
+
+void *poolWorker(void *arg){
+        (void)arg;
+        pthread_mutex_lock(&TP.lock);
+        while(1){
+                poolTask *t = poolTake();
+                if(t) poolRun(t);
+                else pthread_cond_wait(&TP.work, &TP.lock); // sleep until something is submitted
+        }
+        return NULL;
+}
+
+// wait until every task of g finished, helping out with queued tasks meanwhile
+void poolWait(taskGroup *g){
+        pthread_mutex_lock(&TP.lock);
+        while(g->pending > 0){
+                poolTask *t = poolTake();
+                if(t) poolRun(t);
+                else pthread_cond_wait(&TP.done, &TP.lock);
+        }
+        pthread_mutex_unlock(&TP.lock);
 }
 
 
@@ -789,16 +2268,34 @@ void editorOpen(char *filename){
 
         editorSelectSyntaxHighlight();
 
-        FILE *fp = fopen(filename, "r");
-        if(!fp) die("fopen");
+        int fd = open(filename, O_RDONLY);
+        if(fd == -1) die("open");
+
+        /* map regular files into memory instead of reading them. Only the line offsets are worked out here,
+        a row is copied out of the mapping when it's displayed or edited, so big files open right away */
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+                char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(map != MAP_FAILED){
+                        close(fd); // the mapping stays valid after the fd is closed
+                        editorMapFile(map, st.st_size);
+                        E.dirty = 0;
+                        return;
+                }
+        }
+
+        // anything that can't be mapped (empty files, pipes, ...) is read line by line
+        FILE *fp = fdopen(fd, "r");
+        if(!fp) die("fdopen");
 
         char *line = NULL; // string
         size_t linecap = 0; // line capacity
         ssize_t linelen; // # char returns from getline()
         
-        while ((linelen = getline(&line, &linecap, fp)) != -1){ // read an entire file into E.row
-                while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen -1] == 'r')){
-                        linelen--; // remove \n and \r if at the end of string
+        while ((linelen = getline(&line, &linecap, fp)) != -1){ // read an entire file into E.rows
+                if(linelen > 0 && line[linelen - 1] == '\n'){
+                        linelen--; // remove the \n at the end of string
+                        if(linelen > 0 && line[linelen - 1] == '\r') linelen--; // \r\n line ending, same as rowFileLine()
                 }
 
                 editorInsertRow(E.numrows, line, linelen);
@@ -809,30 +2306,151 @@ void editorOpen(char *filename){
         E.dirty = 0; 
 }
 
-// Function that converts array of erow structs into a single str that is ready to be written out to a file
-char *editorRowsToString(int *buflen){
-        int totlen = 0;
-        int j;
-        for(j = 0; j < E.numrows; j ++){ // loop through every rows and get the size of each row, +1 for newline cha
-                totlen += E.row[j].size + 1;
+/* Line index: finding where every line starts is the only thing done with the whole file when it's opened.
+(1) the file is cut into chunks, (2) each chunk is scanned for '\n' on the thread pool, 16 or 32 bytes at a time with SSE2/AVX2,
+(3) the line starts found in each chunk are joined, in order, into E.lineoff */
+void lineChunkPush(lineChunk *c, size_t off){
+        if(c->n == c->cap){
+                c->cap = c->cap ? c->cap * 2 : 1024;
+                c->starts = realloc(c->starts, c->cap * sizeof(size_t));
         }
-        *buflen = totlen; // will update len from editorSave()
+        c->starts[c->n++] = off;
+}
 
-        char *buf = malloc(totlen);
-        char *p = buf;
-        for(j = 0; j < E.numrows; j++){
-                memcpy(p, E.row[j].chars, E.row[j].size); // copy str to buf
-                p += E.row[j].size; // advance the ptr, p still point to the start of the buffer, buf + 5
-                *p = '\n'; // add a new line
-                p++; // buf + 6
+// plain C version, memchr is vectorized by the C library anyway
+void scanNewlinesScalar(lineChunk *c){
+        const char *p = c->map + c->start, *end = c->map + c->end;
+        while((p = memchr(p, '\n', end - p)) != NULL){
+                p++;
+                lineChunkPush(c, p - c->map); // the next line starts right after the '\n'
         }
-        return buf;
 }
 
-// function to write the string returned by editorRowsToString() to disk
+#if defined(__x86_64__) || defined(__i386__)
+/* compare 16 bytes with '\n' at once, movemask gives one bit per byte that matched.
+Each set bit is a line ending, the lowest bit is cleared with mask & (mask - 1) after it's recorded */
+__attribute__((target("sse2")))
+void scanNewlinesSSE2(lineChunk *c){
+        size_t i = c->start;
+        __m128i nl = _mm_set1_epi8('\n');
+        for(; i + 16 <= c->end; i += 16){
+                unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(c->map + i)), nl));
+                while(mask){
+                        lineChunkPush(c, i + __builtin_ctz(mask) + 1);
+                        mask &= mask - 1;
+                }
+        }
+        for(; i < c->end; i++){ // the last few bytes
+                if(c->map[i] == '\n') lineChunkPush(c, i + 1);
+        }
+}
+
+// same as the SSE2 version, 32 bytes at a time
+__attribute__((target("avx2")))
+void scanNewlinesAVX2(lineChunk *c){
+        size_t i = c->start;
+        __m256i nl = _mm256_set1_epi8('\n');
+        for(; i + 32 <= c->end; i += 32){
+                unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(c->map + i)), nl));
+                while(mask){
+                        lineChunkPush(c, i + __builtin_ctz(mask) + 1);
+                        mask &= mask - 1;
+                }
+        }
+        for(; i < c->end; i++){
+                if(c->map[i] == '\n') lineChunkPush(c, i + 1);
+        }
+}
+#endif
+
+// task run on the pool, scan one chunk with the widest kernel the CPU has
+void scanNewlines(void *arg){
+        lineChunk *c = arg;
+        c->cap = (c->end - c->start) / 32 + 16; // guess ~32 chars per line so the array rarely grows
+        c->starts = malloc(c->cap * sizeof(size_t));
+#if defined(__x86_64__) || defined(__i386__)
+        if(__builtin_cpu_supports("avx2")) scanNewlinesAVX2(c);
+        else if(__builtin_cpu_supports("sse2")) scanNewlinesSSE2(c);
+        else scanNewlinesScalar(c);
+#else
+        scanNewlinesScalar(c);
+#endif
+}
+
+// make the whole file one run of unloaded lines, remembering where each line starts
+void editorMapFile(char *map, size_t size){
+        // stage 1: chunks, a few per thread so a thread that finishes early can pick up more work
+        size_t nchunks = size / LINE_CHUNK_SIZE + 1;
+        size_t most = poolThreads() * 4;
+        if(nchunks > most) nchunks = most;
+        size_t chunksize = size / nchunks + 1;
+
+        lineChunk *chunks = calloc(nchunks, sizeof(lineChunk));
+        taskGroup group = TASKGROUP_INIT;
+        for(size_t i = 0; i < nchunks; i++){
+                chunks[i].map = map;
+                chunks[i].start = i * chunksize < size ? i * chunksize : size;
+                chunks[i].end = (i + 1) * chunksize < size ? (i + 1) * chunksize : size;
+                // stage 2: scan them on the pool, a single chunk is just scanned here
+                if(nchunks == 1) scanNewlines(&chunks[i]);
+                else poolSubmit(&group, scanNewlines, &chunks[i]);
+        }
+        poolWait(&group);
+
+        // stage 3: join them. Line 0 starts at 0, a '\n' at the very end of the file doesn't start another line
+        size_t nlines = 1;
+        for(size_t i = 0; i < nchunks; i++) nlines += chunks[i].n;
+        size_t *lineoff = malloc((nlines + 1) * sizeof(size_t));
+        size_t n = 0;
+        lineoff[n++] = 0;
+        for(size_t i = 0; i < nchunks; i++){
+                memcpy(&lineoff[n], chunks[i].starts, chunks[i].n * sizeof(size_t));
+                n += chunks[i].n;
+                free(chunks[i].starts);
+        }
+        free(chunks);
+        if(lineoff[n - 1] == size) n--;
+        lineoff[n] = size;
+
+        editorCloseFile();
+        E.map = map;
+        E.mapsize = size;
+        E.lineoff = lineoff;
+        E.hlstate = calloc(n + 1, 1); // no state worked out yet, see editorSyntaxKnow()
+        E.numrows = n;
+        rowSetRoot(n ? rowNewNode(0, n) : NULL);
+}
+
+// drop every row and unmap the file
+void editorCloseFile(){
+        rowSetRoot(NULL);
+        rowLongReleaseAll();
+        rowAllocRelease(); // every row at once, instead of going through the tree freeing them one by one
+        E.cache_head = E.cache_tail = NULL;
+        E.cached = 0;
+        E.numrows = 0;
+        E.hl_from = E.hl_to = -1;
+        E.hl_known = 0;
+        if(E.map) munmap(E.map, E.mapsize);
+        free(E.lineoff);
+        free(E.hlstate);
+        E.map = NULL;
+        E.mapsize = 0;
+        E.lineoff = NULL;
+        E.hlstate = NULL;
+}
+
+/* Saving: the text is written to a temp file next to the file, which is synced & then renamed over the file. The file is either
+all old or all new, never half written, even if the editor or the machine dies in the middle. It happens on its own thread
+while editing goes on, from a snapshot taken by saveSnapshot(). Unloaded lines are written straight from the mapped file with writev(),
+nothing is copied but the loaded rows. The mapping is of the file's old contents, which renaming over it leaves alone */
 void editorSave(){
+        if(E.save){
+                editorSetStatusMessage("Still saving, try again when it's done");
+                return;
+        }
         if(E.filename == NULL){
-                E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+                E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL, 0);
                 if(E.filename == NULL){
                         editorSetStatusMessage("Save Aborted");
                         return;
@@ -840,29 +2458,199 @@ void editorSave(){
                 editorSelectSyntaxHighlight();
         }
 
-        int len;
-        char *buf = editorRowsToString(&len); // returns new len after the function call, len is pointing to totlen
-
-        int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-        if(fd != -1){ // return -1 on erroe
-                /* set the file size to specified length  If the file is larger than that, 
-                 it will cut off any data at the end of the file to make it that length. 
-                 If the file is shorter, it will add 0 bytes at the end to make it that length.*/
-                if(ftruncate(fd, len) != -1){ // return -1 on erro
-                        if (write(fd, buf, len) == len){ // return # of bytes told to write
-                                // if error occurs or not
-                                close(fd);
-                                free(buf);
-                                E.dirty = 0;
-                                editorSetStatusMessage("%d bytes written to disk", len);
-                                return;
+        saveJob *job = saveSnapshot();
+        E.save = job;
+        if(pthread_create(&job->thread, NULL, saveThread, job) != 0){ // no thread, save right here instead
+                saveThread(job);
+                job->thread = pthread_self(); // nothing to join
+        }
+        editorSetStatusMessage("Saving %s...", E.filename);
+        EV.timers[TIMER_SAVE] = eventNow() + SAVE_POLL;
+}
+
+/* Take down the text of every row the way searchSnapshot() does, except the loaded rows are copied: they can change while the save runs.
+Consecutive loaded rows are copied one after another with their \n into SAVE_BLOCK blocks, each block is one piece */
+saveJob *saveSnapshot(){
+        saveJob *job = calloc(1, sizeof(saveJob));
+        char resolved[PATH_MAX];
+        job->path = strdup(realpath(E.filename, resolved) ? resolved : E.filename); // save through a symlink, not over it
+        struct stat st;
+        if(stat(job->path, &st) == 0){
+                job->mode = st.st_mode & 07777; // the file keeps its permissions
+        }
+        else{
+                mode_t mask = umask(0); // a new file gets what open(..., 0644) would have given it
+                umask(mask);
+                job->mode = 0644 & ~mask;
+        }
+        job->dirty = E.dirty;
+
+        int cap = 64, off;
+        job->pieces = malloc(cap * sizeof(savePiece));
+        char *block = NULL;
+        size_t used = 0, size = 0; // of block
+        for(rowNode *n = rowFind(0, &off); n; n = rowNodeNext(n)){
+                if(job->npieces == cap){
+                        cap *= 2;
+                        job->pieces = realloc(job->pieces, cap * sizeof(savePiece));
+                }
+                savePiece *p = &job->pieces[job->npieces];
+                if(n->fileline != -1){
+                        p->text = E.map + E.lineoff[n->fileline];
+                        p->len = E.lineoff[n->fileline + n->nlines] - E.lineoff[n->fileline];
+                        p->mapped = 1;
+                        p->eof = (E.lineoff[n->fileline + n->nlines] == E.mapsize);
+                        job->npieces++;
+                        job->total += p->len;
+                        block = NULL; // the next loaded row starts a new piece, in a new block
+                        continue;
+                }
+                erow *row = &n->row;
+                size_t need = row->size + 1;
+                if(block == NULL || used + need > size){ // start a new block
+                        size = need > SAVE_BLOCK ? need : SAVE_BLOCK;
+                        block = malloc(size);
+                        used = 0;
+                        job->blocks = realloc(job->blocks, (job->nblocks + 1) * sizeof(char *));
+                        job->blocks[job->nblocks++] = block;
+                        p->text = block;
+                        p->len = 0;
+                        p->mapped = p->eof = 0;
+                        job->npieces++;
+                }
+                p = &job->pieces[job->npieces - 1];
+                rowCopy(row, 0, row->size, &block[used]);
+                block[used + row->size] = '\n';
+                used += need;
+                p->len += need;
+                job->total += need;
+        }
+        return job;
+}
+
+// write out the iovecs collected so far, all of them: writev() may write less than asked. Returns -1 on an error
+int saveFlush(struct iovec *iov, int n, saveJob *job, int fd){
+        int i = 0;
+        while(i < n){
+                ssize_t w = writev(fd, &iov[i], n - i);
+                if(w == -1){
+                        if(errno == EINTR) continue;
+                        return -1;
+                }
+                job->written += w;
+                while(i < n && (size_t)w >= iov[i].iov_len) w -= iov[i++].iov_len; // skip what was written completely
+                if(i < n){ // the rest of a partly written one
+                        iov[i].iov_base = (char *)iov[i].iov_base + w;
+                        iov[i].iov_len -= w;
+                }
+        }
+        return 0;
+}
+
+// add len bytes at s to the batch, writing the batch out once IOV_MAX of them are collected
+void savePush(struct iovec *iov, int *n, const char *s, size_t len, saveJob *job, int fd){
+        if(len == 0 || job->err) return;
+        if(*n == IOV_MAX){
+                if(saveFlush(iov, *n, job, fd) == -1) job->err = errno;
+                *n = 0;
+        }
+        iov[*n].iov_base = (void *)s;
+        iov[*n].iov_len = len;
+        (*n)++;
+}
+
+/* the save thread. The mapped lines are written as they are in the file, except a \r right before a \n is left out and the file
+ends with a \n, like the lines are when they're loaded as rows. memchr() finds the \r's, a file without them is written in one go */
+void *saveThread(void *arg){
+        saveJob *job = arg;
+        size_t len = strlen(job->path);
+        char *tmp = malloc(len + 8);
+        memcpy(tmp, job->path, len);
+        memcpy(tmp + len, ".XXXXXX", 8); // in the same directory, rename() can't move a file to another filesystem
+        int fd = mkstemp(tmp);
+        if(fd == -1){
+                job->err = errno;
+                free(tmp);
+                __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+                return NULL;
+        }
+        if(fchmod(fd, job->mode) == -1) job->err = errno;
+
+        struct iovec iov[IOV_MAX];
+        int n = 0;
+        for(int i = 0; i < job->npieces && !job->err; i++){
+                savePiece *p = &job->pieces[i];
+                const char *s = p->text, *end = p->text + p->len;
+                int newline = 0;
+                if(p->mapped && p->eof && p->len && end[-1] != '\n') newline = 1; // the last line has no \n, a \r it ends in is kept like rowFileLine() does
+                while(s < end && p->mapped){
+                        const char *cr = memchr(s, '\r', end - s);
+                        if(cr == NULL) break;
+                        if(cr + 1 < end && cr[1] == '\n'){ // \r\n, skip the \r
+                                savePush(iov, &n, s, cr - s, job, fd);
+                                s = cr + 1;
+                        }
+                        else{ // a \r on its own is part of the text
+                                savePush(iov, &n, s, cr + 1 - s, job, fd);
+                                s = cr + 1;
                         }
                 }
-                close(fd);
+                savePush(iov, &n, s, end - s, job, fd);
+                if(newline) savePush(iov, &n, "\n", 1, job, fd);
+                __atomic_store_n(&job->consumed, job->consumed + p->len, __ATOMIC_RELAXED);
+        }
+        if(!job->err && saveFlush(iov, n, job, fd) == -1) job->err = errno;
+        if(!job->err && fsync(fd) == -1) job->err = errno; // on disk before it replaces the file
+        if(close(fd) == -1 && !job->err) job->err = errno;
+        if(!job->err && rename(tmp, job->path) == -1) job->err = errno;
+        if(job->err) unlink(tmp);
+        else{ // make the rename itself stick
+                char *slash = strrchr(job->path, '/');
+                char *dir = slash ? strndup(job->path, slash == job->path ? 1 : slash - job->path) : strdup(".");
+                int dfd = open(dir, O_RDONLY);
+                if(dfd != -1){
+                        fsync(dfd);
+                        close(dfd);
+                }
+                free(dir);
         }
+        free(tmp);
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        return NULL;
+}
 
-        free(buf);
-        editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno)); // returns human-readable string for that error code
+/* check on the save. While it runs the status bar shows how far it is, wait makes this wait for it to finish.
+Returns 1 if no save is running any more */
+int saveFinish(int wait){
+        saveJob *job = E.save;
+        if(job == NULL) return 1;
+        if(!wait && !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)){
+                size_t consumed = __atomic_load_n(&job->consumed, __ATOMIC_RELAXED);
+                editorSetStatusMessage("Saving %s... %d%%", E.filename, job->total ? (int)(consumed * 100 / job->total) : 0);
+                editorRequestRedraw();
+                return 0;
+        }
+        if(!pthread_equal(job->thread, pthread_self())) pthread_join(job->thread, NULL);
+        if(job->err){
+                editorSetStatusMessage("Cannot save! I/O error: %s", strerror(job->err)); // returns human-readable string for that error code
+        }
+        else{
+                if(E.dirty == job->dirty) E.dirty = 0; // not edited while saving
+                editorSetStatusMessage("%zu bytes written to disk", job->written);
+        }
+        editorRequestRedraw();
+        saveFree(job);
+        E.save = NULL;
+        EV.timers[TIMER_SAVE] = 0;
+        return 1;
+}
+
+void saveFree(saveJob *job){
+        for(int i = 0; i < job->nblocks; i++) free(job->blocks[i]);
+        free(job->blocks);
+        free(job->pieces);
+        free(job->path);
+        free(job);
 }
 
 // Find
@@ -873,7 +2661,7 @@ void editorFind(){
         int saved_coloff = E.coloff;
         int saved_rowoff = E.rowoff;
         
-        char *query = editorPrompt("Search: %s (ESC / Arrows / Enter)", editorFindCallback);
+        char *query = editorPrompt("Search: %s (ESC / Arrows / Enter / Ctrl-E regex)", editorFindCallback, 0);
         
         if(query){ // user complete the search
                 free(query);
@@ -886,374 +2674,2807 @@ void editorFind(){
         }
 }
 
-/* search feature: When the user types a search query and presses Enter. Loop through all the rows of the file, and if a row contains their query string, move the cursor to the match
-Search forward and backward: The ↑ and ← keys will go to the previous match, and the ↓ and → keys will go to the next match. */
+/* search feature: When the user types a search query and presses Enter. Every match of the query in the file is found & kept in E.matches, the cursor moves to the nearest one after
+where it was when the search started. The file is searched on the thread pool so the prompt doesn't wait for it, see searchStart()
+Search forward and backward: The ↑ and ← keys will go to the previous match, and the ↓ and → keys will go to the next match. That's just the neighbouring entry of E.matches, no searching */
 void editorFindCallback(char *query, int key){
-        static int last_match = -1; // contain the index of the row the last match was on, -1 if there was no last match
-        static int direction = 1; // store the direction of the match: 1 searching forward, -1 searching backward
-
-        static int saved_hl_line; // to know which line need to be restored
-        static char *saved_hl = NULL; // points to NULL if there's nothing to restored
-
-        if(saved_hl){
-                memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-                free(saved_hl);
-                saved_hl = NULL; // set back to NULL after restore
-        }
-
+        matchIndex *mi = &E.matches;
         if (key == '\r' || key == '\x1b') { // leaving search mode so return immediately instead of doing another search
-                last_match = -1;
-                direction = 1;
+                matchIndexFree(mi);
                 return;
         }
-        else if(key == ARROW_RIGHT || key == ARROW_DOWN){
-                direction = 1;
+        if(!mi->active){ // the prompt just opened
+                mi->active = 1;
+                mi->origin_row = E.cy;
+                mi->origin_cx = E.cx;
+                searchSnapshot(mi);
+        }
+
+        if(mi->job == NULL && mi->n && (key == ARROW_RIGHT || key == ARROW_DOWN)){
+                mi->cur = (mi->cur + 1) % mi->n; // wrap around to the first match
+                editorFindShow(mi, mi->m[mi->cur].row, mi->m[mi->cur].cx, mi->m[mi->cur].len);
+        }
+        else if(mi->job == NULL && mi->n && (key == ARROW_LEFT || key == ARROW_UP)){
+                mi->cur = (mi->cur - 1 + mi->n) % mi->n; // wrap around to the last match
+                editorFindShow(mi, mi->m[mi->cur].row, mi->m[mi->cur].cx, mi->m[mi->cur].len);
         }
-        else if(key == ARROW_LEFT || key == ARROW_UP){
-                direction = -1;
+        else if(key == CTRL_KEY('e')){ // switch between plain text & regex, and search again
+                mi->regex = !mi->regex;
+                editorFindRestore(mi);
+                searchStart(mi, query);
+                searchPoll(mi);
         }
-        else{ // reset values back to the original
-                last_match = -1; 
-                direction = 1;
+        else if(mi->query == NULL || strcmp(mi->query, query)){ // the query changed, search for it
+                searchStart(mi, query);
+                searchPoll(mi); // the range with the cursor is already done
         }
+}
 
-        if(last_match == -1) direction = 1;
-        int current = last_match; // store the of the current row searching
+// move the cursor to a match & highlight it
+void editorFindShow(matchIndex *mi, int row, int cx, int len){
+        editorFindRestore(mi);
+        E.cy = row;
+        E.cx = cx;
+        E.rowoff = E.numrows; /* set row offset to scroll to the bottom of the file. Which will cause editorScroll() to scroll upwards at the next screen refresh so that the matching line will be at the very top of the screen */
 
-        // else after any other keypress, do another seach for the current query string
-        int i;
-        for(i = 0; i < E.numrows; i++){
-                current += direction;
-                if(current == -1) current = E.numrows - 1; // set to the last row
-                else if(current == E.numrows) current = 0; // set to the first row
+        mi->shown_row = row; // editorDrawRows() highlights it, the row's hl stays as it is
+        mi->shown_cx = cx;
+        mi->shown_len = len;
+}
 
-                erow *row = &E.row[current];
-                char *match = strstr(row->render, query); // query is a substr of row->render, return a ptr point to the 1st char in substr matched
-                if(match){
-                        last_match = current; // if it's match, the user presses the arrow keys, it'll start the next search from that point, also update last_match
-                        E.cy = current;
-                        E.cx = editorRowRxToCx(row, match - row->render); // covert to an index
-                        E.rowoff = E.numrows; /* set row offset to scroll to the bottom of the file. Which will cause editorScroll() to scroll upwards at the next screen refresh so that the matching line will be at the very top of the screen */
+// take the highlight off the match shown last
+void editorFindRestore(matchIndex *mi){
+        mi->shown_len = 0;
+}
 
-                        saved_hl_line = current;
-                        saved_hl = malloc(row->rsize);
-                        memcpy(saved_hl, row->hl, row->rsize);
-                        memset(&row->hl[match - row->render], HL_MATCH, strlen(query)); // match - row->render is the index into render of the match, so use that as the index into hl
-                        break;
-                }
+/* Replace every match of a query with some text: plain text, or a regex if the last search was in regex mode (Ctrl-E in the search prompt).
+The cursor stays where it was, and the whole replace is undone with one Ctrl-Z */
+void editorReplace(){
+        char *query = editorPrompt(E.matches.regex ? "Replace regex: %s (ESC to cancel)" : "Replace: %s (ESC to cancel)", NULL, 0);
+        if(query == NULL) return;
+        char *with = editorPrompt("Replace with: %s (Enter on nothing deletes, ESC to cancel)", NULL, 1);
+        if(with){
+                editorReplaceAll(query, with);
+                free(with);
         }
+        free(query);
 }
 
+/* The matches are found by the search engine on the thread pool, like for Find, then each row with matches is rewritten once by
+editorReplaceRow(). Returns how many matches were replaced */
+int editorReplaceAll(char *query, char *with){
+        matchIndex *mi = &E.matches;
+        int cx = E.cx, cy = E.cy, rowoff = E.rowoff, coloff = E.coloff;
+        matchIndexFree(mi);
+        mi->active = 1;
+        mi->origin_row = 0;
+        mi->origin_cx = 0;
+        searchSnapshot(mi);
+        searchStart(mi, query);
+        while(mi->job){ // every match, in file order
+                poolWait(&mi->job->group);
+                searchPoll(mi);
+        }
+        if(mi->error){
+                editorSetStatusMessage("Bad regex: %s", mi->error);
+                matchIndexFree(mi);
+                return 0;
+        }
+        int n = mi->n;
+        searchMatch *m = mi->m;
+        mi->m = NULL; // kept, the rest of the index goes
+        matchIndexFree(mi);
+
+        E.cy = cy; // showing the first match moved the cursor, the undo history gets the one the user had
+        E.cx = cx;
+        E.rowoff = rowoff;
+        E.coloff = coloff;
+        int wlen = strlen(with);
+        undoBegin(); // one edit
+        for(int i = 0; i < n; ){
+                int k = i + 1;
+                while(k < n && m[k].row == m[i].row) k++; // the matches on the same row
+                editorReplaceRow(m[i].row, &m[i], k - i, with, wlen);
+                i = k;
+        }
+        undoEnd();
+        free(m);
 
-/***** Row Operation *****/
-/* This function allocate space for a new erow, and then copy the given str to a new erow at the end of the E.row array 
-It will now be able to insert a row at the index specified by the new at argument. */
-void editorInsertRow(int at, char *s, size_t len){
-        if(at < 0 || at > E.numrows) return;
-
-        E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1)); // reallocate for one more erow
-        memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at)); // make room at the specified index for the new row, shift current row down
+        erow *row = editorRowAt(E.cy);
+        E.cx = row && cx > row->size ? row->size : cx; // the row may be shorter now
+        editorSetStatusMessage("Replaced %d occurrence%s", n, n == 1 ? "" : "s");
+        return n;
+}
 
-        for(int j = at + 1; j <= E.numrows; j++) E.row[j].idx++; // update the index of each row that was displaced by the insert or delete operation
+/* Substring search. Like memmem(), returns the first place q (m chars) occurs in s (n chars), or NULL.
+The vector versions look for the first & last char of q at once in 16 or 32 positions: a position is only compared in full
+if both of those chars are in the right place, which is rare in normal text */
+const char *searchScalar(const char *s, size_t n, const char *q, size_t m){
+        return memmem(s, n, q, m);
+}
 
-        E.row[at].idx = at; // initialize idx to the row’s index in the file at the time it is inserted
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+const char *searchSSE2(const char *s, size_t n, const char *q, size_t m){
+        size_t i = 0;
+        __m128i first = _mm_set1_epi8(q[0]);
+        __m128i last = _mm_set1_epi8(q[m - 1]);
+        for(; i + m - 1 + 16 <= n; i += 16){
+                __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), first);
+                __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + m - 1)), last);
+                unsigned int mask = _mm_movemask_epi8(_mm_and_si128(f, l)); // bit k set: q could start at i + k
+                while(mask){
+                        size_t at = i + __builtin_ctz(mask);
+                        if(!memcmp(s + at + 1, q + 1, m - 2)) return s + at; // first & last char already matched
+                        mask &= mask - 1;
+                }
+        }
+        return searchScalar(s + i, n - i, q, m); // the last few positions
+}
 
-        E.row[at].size = len; // update the size of the current row
-        E.row[at].chars = malloc(len + 1); // allocate memory 
-        memcpy(E.row[at].chars, s, len); // copy the str to newly allocated memory
-        E.row[at].chars[len] = '\0'; // make the end of a st
-        
-        E.row[at].rsize = 0;
-        E.row[at].render = NULL;
-        E.row[at].hl = NULL;
-        E.row[at].hl_open_comment = 0;
-        editorUpdateRow(&E.row[at]);
+__attribute__((target("avx2")))
+const char *searchAVX2(const char *s, size_t n, const char *q, size_t m){
+        size_t i = 0;
+        __m256i first = _mm256_set1_epi8(q[0]);
+        __m256i last = _mm256_set1_epi8(q[m - 1]);
+        for(; i + m - 1 + 32 <= n; i += 32){
+                __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), first);
+                __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + m - 1)), last);
+                unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(f, l));
+                while(mask){
+                        size_t at = i + __builtin_ctz(mask);
+                        if(!memcmp(s + at + 1, q + 1, m - 2)) return s + at;
+                        mask &= mask - 1;
+                }
+        }
+        return searchScalar(s + i, n - i, q, m);
+}
+#endif
+
+// search with the widest kernel the CPU has
+const char *searchFind(const char *s, size_t n, const char *q, size_t m){
+        if(m == 0 || m > n) return NULL;
+        if(m == 1) return memchr(s, q[0], n);
+#if defined(__x86_64__) || defined(__i386__)
+        if(__builtin_cpu_supports("avx2")) return searchAVX2(s, n, q, m);
+        if(__builtin_cpu_supports("sse2")) return searchSSE2(s, n, q, m);
+#endif
+        return searchScalar(s, n, q, m);
+}
 
-        E.numrows++; // update the newly row, reprent 1 row with text
-        E.dirty++; // incremnet bc make changes to text
+void searchRangePush(searchRange *r, int row, int cx, int len){
+        if(r->n == r->cap){
+                r->cap = r->cap ? r->cap * 2 : 64;
+                r->m = realloc(r->m, r->cap * sizeof(searchMatch));
+        }
+        r->m[r->n].row = row;
+        r->m[r->n].cx = cx;
+        r->m[r->n].len = len;
+        r->n++;
 }
 
-// this function uses the chars str of an erow to fill in the contents of the render str
-void editorUpdateRow(erow *row) {
-        int tabs = 0;
-        int j;
-        for(j = 0; j < row->size; j++){
-                if(row->chars[j] == '\t') tabs++; // go through chars of the row & count the tabs in order to know how much memory to allocate for rende
+/* Take down where the text of every row is, so search tasks can read it without touching the row tree, which only the main thread may use.
+Nothing is edited while the prompt is open, so the text stays put: rows loaded meanwhile are copies, the mapped file is still there.
+A run of unloaded lines is cut in pieces of about SEARCH_RANGE_BYTES, each searched in one go since its lines are next to each other in the mapped file */
+void searchSnapshot(matchIndex *mi){
+        int cap = 64, off;
+        mi->npieces = 0;
+        mi->pieces = malloc(cap * sizeof(searchPiece));
+        int at = 0; // index of the first row of n
+        for(rowNode *n = rowFind(0, &off); n; n = rowNodeNext(n)){
+                int line = n->fileline, end = n->fileline + n->nlines;
+                do{
+                        if(mi->npieces == cap){
+                                cap *= 2;
+                                mi->pieces = realloc(mi->pieces, cap * sizeof(searchPiece));
+                        }
+                        searchPiece *p = &mi->pieces[mi->npieces++];
+                        if(n->fileline == -1){
+                                p->text = n->row.chars;
+                                if(n->row.longrow){ // a row in chunks is copied in one piece, a match may cross from one chunk to the next
+                                        char *s = malloc(n->row.size + 1);
+                                        rowCopy(&n->row, 0, n->row.size, s);
+                                        mi->copies = realloc(mi->copies, (mi->ncopies + 1) * sizeof(char *));
+                                        mi->copies[mi->ncopies++] = s;
+                                        p->text = s;
+                                }
+                                p->len = n->row.size;
+                                p->row = at;
+                                p->fileline = -1;
+                                break;
+                        }
+                        // the last line that still ends within SEARCH_RANGE_BYTES, at least one line
+                        size_t limit = E.lineoff[line] + SEARCH_RANGE_BYTES;
+                        int lo = line + 1, hi = end;
+                        while(lo < hi){
+                                int mid = (lo + hi + 1) / 2;
+                                if(E.lineoff[mid] <= limit) lo = mid;
+                                else hi = mid - 1;
+                        }
+                        p->text = E.map + E.lineoff[line];
+                        p->len = E.lineoff[lo] - E.lineoff[line];
+                        p->row = at + line - n->fileline;
+                        p->fileline = line;
+                        line = lo;
+                } while(line < end);
+                at += n->nlines;
         }
+}
 
-        free(row->render);
-        row->render = malloc(row->size + tabs*(ONREE_TAB_STOP - 1) + 1); // allocate mem with tabs
-        
-        int idx = 0;
-        for (j = 0; j < row->size; j++) {
-                if(row->chars[j] == '\t'){ // if the current char is a tab, append one space bc each tab must advance the cursor forward at least 1 col
-                        row->render[idx++] = ' ';
-                        while(idx % ONREE_TAB_STOP != 0) row->render[idx++] = ' ';// then apppend spaces til get to the tab stop, which is a col that divisible by 8
+/* task run on the pool: find the matches in one range. The query can't contain a '\n', so a match never spans two lines.
+Checks between pieces whether a newer query came in, and stops if so */
+void searchTask(void *arg){
+        searchRange *r = arg;
+        matchIndex *mi = &E.matches;
+        const char *query = mi->query; // not freed until every task of the job finished
+        size_t qlen = strlen(query);
+        for(int i = r->first; i < r->last; i++){
+                if(__atomic_load_n(&mi->gen, __ATOMIC_RELAXED) != r->job->gen) break; // stale
+                searchPiece *piece = &mi->pieces[i];
+                if(mi->re){ // a regex is matched line by line
+                        if(piece->fileline == -1) searchLine(r, piece->text, piece->len, piece->row);
+                        else{
+                                for(int line = piece->fileline; E.lineoff[line] < E.lineoff[piece->fileline] + piece->len; line++){
+                                        int len;
+                                        char *text = rowFileLine(line, &len);
+                                        searchLine(r, text, len, piece->row + line - piece->fileline);
+                                }
+                        }
+                        continue;
                 }
-                else{
-                        row->render[idx++] = row->chars[j]; // copy each char to rende
+                const char *p = piece->text, *end = piece->text + piece->len;
+                int line = piece->fileline;
+                while((p = searchFind(p, end - p, query, qlen)) != NULL){
+                        if(line == -1) searchRangePush(r, piece->row, p - piece->text, qlen);
+                        else{
+                                size_t pos = p - E.map;
+                                while(E.lineoff[line + 1] <= pos) line++; // the line the match is on
+                                searchRangePush(r, piece->row + line - piece->fileline, pos - E.lineoff[line], qlen);
+                        }
+                        p += qlen; // matches don't overlap
                 }
         }
-        row->render[idx] = '\0';
-        row->rsize = idx; // update the size of row
+        __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE); // the matches are in place before done is seen
+}
 
-        editorUpdateSyntax(row); // editorUpdateRow updating the render array whenever the text of row changes, so this is where hl array need to be update
+// regex matches in one line of text
+void searchLine(searchRange *r, const char *text, int len, int row){
+        regexSearchLine(E.matches.re, text, len, row, r);
 }
 
-// function that converts a chars index into a render index
-int editorRowCxToRx(erow *row, int cx){
-        int rx = 0;
-        int j;
-        for (j = 0; j < cx; j++) { // loop through all the chars to the left fo cx
-                if (row->chars[j] == '\t') {// if it's a tab
-                /* use rx % KILO_TAB_STOP to find out how many columns we are to the right of the last tab stop, 
-                then subtract that from KILO_TAB_STOP - 1 to find out how many columns we are to the left of the next tab stop
-                Add that amount to rx to get just to the left of the next tab stop,*/
-                        rx += (ONREE_TAB_STOP - 1) - (rx % ONREE_TAB_STOP);
-                }
-                rx++; // to get right on the next tab stop
+/* Start searching for query: the pieces are grouped in ranges, the range with the origin is searched right here so the nearest match shows
+up right away, the others are queued on the pool in order from there, wrapping around at the end of the file. searchPoll() picks up the results */
+void searchStart(matchIndex *mi, char *query){
+        searchCancel(mi);
+        free(mi->query);
+        mi->query = strdup(query);
+        mi->n = 0;
+        mi->cur = -1;
+        mi->found = 0;
+        free(mi->m);
+        mi->m = NULL;
+        mi->cap = 0;
+        regexFree(mi->re);
+        mi->re = NULL;
+        free(mi->error);
+        mi->error = NULL;
+        if(query[0] == '\0' || mi->npieces == 0) return;
+        if(mi->regex){ // compiled once here, every task runs the same NFA
+                mi->re = regexCompile(query, &mi->error);
+                if(mi->re == NULL) return;
         }
-        return rx;
+
+        searchJob *j = malloc(sizeof(searchJob));
+        j->gen = __atomic_add_fetch(&mi->gen, 1, __ATOMIC_RELAXED);
+        j->group = (taskGroup)TASKGROUP_INIT;
+        j->ranges = malloc(mi->npieces * sizeof(searchRange)); // at most one range per piece
+        j->nranges = 0;
+        j->start = 0;
+        for(int i = 0; i < mi->npieces; ){
+                searchRange *r = &j->ranges[j->nranges++];
+                memset(r, 0, sizeof(searchRange));
+                r->job = j;
+                r->first = i;
+                size_t bytes = 0;
+                while(i < mi->npieces && bytes < SEARCH_RANGE_BYTES && i - r->first < SEARCH_RANGE_ROWS) bytes += mi->pieces[i++].len;
+                r->last = i;
+                if(mi->pieces[r->first].row <= mi->origin_row) j->start = j->nranges - 1;
+        }
+        mi->job = j;
+
+        searchTask(&j->ranges[j->start]);
+        for(int k = 1; k < j->nranges; k++) poolSubmit(&j->group, searchTask, &j->ranges[(j->start + k) % j->nranges]);
 }
 
-// function that inserts a single character into an erow, at a given position.
-void editorRowInsertChar(erow *row, int at, int c){
-        if (at < 0 || at > row->size) at = row->size; // validate the index want to insert the char into, at can go 1 char past the end of st
-        row->chars = realloc(row->chars, row->size + 2); // allocate 1 more byte fo chars of the erow (2 bc for the null)
-        // increment the size of the chars array, then assign the character to its position in the array
-        memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-        row->size++;
-        row->chars[at] = c; // place a char at a certain position
-        editorUpdateRow(row); // so that render & rsize fields get updated with new row content
-        E.dirty++; // incremnet bc make changes to text
+// stop the running search, if any, and wait for its tasks to be gone
+void searchCancel(matchIndex *mi){
+        searchJob *j = mi->job;
+        if(j == NULL) return;
+        __atomic_add_fetch(&mi->gen, 1, __ATOMIC_RELAXED);
+        poolWait(&j->group); // queued tasks see they're stale and return right away
+        for(int i = 0; i < j->nranges; i++) free(j->ranges[i].m);
+        free(j->ranges);
+        free(j);
+        mi->job = NULL;
 }
 
-// Simple backspacing: function which deletes a char in an erow
-void editorRowDelChar(erow *row, int at){
-        if(at < 0 || at >= row->size) return;
-        memmove(&row->chars[at], &row->chars[at+1], row->size - at); // move the next char to the current cha
-        row->size--;
-        editorUpdateRow(row);
-        E.dirty++;
+/* Collect what the running search found so far, called when idle. Returns 1 if the screen needs redrawing.
+The first match shown is the nearest one after the origin, which is known once every range before it is done.
+When the last range is done, its matches are put together in file order in mi->m */
+int searchPoll(matchIndex *mi){
+        searchJob *j = mi->job;
+        if(j == NULL) return 0;
+        int n = 0, all = 1;
+        for(int i = 0; i < j->nranges; i++){
+                if(__atomic_load_n(&j->ranges[i].done, __ATOMIC_ACQUIRE)) n += j->ranges[i].n;
+                else all = 0;
+        }
+        int changed = n != mi->n;
+        mi->n = n;
+
+        for(int k = 0; !mi->found && k <= j->nranges; k++){ // the origin's range, the ones after it, then the origin's range again for matches before the origin
+                int ri = (j->start + k) % j->nranges;
+                searchRange *r = &j->ranges[ri];
+                if(!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) break;
+                for(int i = 0; i < r->n; i++){
+                        int after = r->m[i].row > mi->origin_row || (r->m[i].row == mi->origin_row && r->m[i].cx >= mi->origin_cx);
+                        if(k == 0 && !after) continue;
+                        mi->found = 1;
+                        mi->sel_range = ri;
+                        mi->sel_i = i;
+                        editorFindShow(mi, r->m[i].row, r->m[i].cx, r->m[i].len);
+                        changed = 1;
+                        break;
+                }
+        }
+
+        if(all){
+                mi->m = malloc((n ? n : 1) * sizeof(searchMatch));
+                mi->cap = n;
+                int at = 0;
+                for(int i = 0; i < j->nranges; i++){
+                        if(mi->found && i == mi->sel_range) mi->cur = at + mi->sel_i;
+                        memcpy(&mi->m[at], j->ranges[i].m, j->ranges[i].n * sizeof(searchMatch));
+                        at += j->ranges[i].n;
+                }
+                searchCancel(mi); // nothing left to cancel, just frees the job
+                changed = 1;
+        }
+        return changed;
+}
+
+void matchIndexFree(matchIndex *mi){
+        searchCancel(mi);
+        editorFindRestore(mi);
+        free(mi->m);
+        free(mi->query);
+        free(mi->pieces);
+        for(int i = 0; i < mi->ncopies; i++) free(mi->copies[i]);
+        free(mi->copies);
+        regexFree(mi->re);
+        free(mi->error);
+        int gen = mi->gen; // never reused, a task of an old search can't mistake a new search for its own
+        int regex = mi->regex; // the next search starts in the same mode
+        memset(mi, 0, sizeof(matchIndex));
+        mi->gen = gen;
+        mi->regex = regex;
+        mi->cur = -1;
 }
 
 
-/* The 2 functions below is implementing backspacing at the start of a line. When the user backspace at the begining of a line, append the contents
-of that line to the previous line, and then delete the current line. This backspaces the implicit \n char in the between the 2 lines to join them into 1 */
-void editorFreeRow(erow * row){
-        free(row->render);
-        free(row->chars);
-        free(row->hl);
+/***** Regex *****/
+/* Supported: literal chars, . [abc] [^a-z] \d \w \s \D \W \S, escapes like \. \t, ( ) for grouping, | * + ? {m} {m,} {m,n}, and ^ $ for the start & end of a line.
+A regex matches within a line and finds the leftmost-longest match, like grep */
+regexAST *regexNewAST(int type, regexAST *a, regexAST *b){
+        regexAST *t = calloc(1, sizeof(regexAST));
+        t->type = type;
+        t->a = a;
+        t->b = b;
+        return t;
 }
 
-void editorDelRow(int at){
-        if(at < 0 || at >= E.numrows) return;
-        editorFreeRow(&E.row[at]); // free the memory owned by the row
-        memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at -1)); // shift all rows after deleted row 1 position to the left
-        E.numrows--;
-        E.dirty++;
+void regexFreeAST(regexAST *t){
+        if(t == NULL) return;
+        regexFreeAST(t->a);
+        regexFreeAST(t->b);
+        free(t);
 }
 
-// function which append a str to the end of a row
-void editorRowAppendString(erow *row, char *s, size_t len){
-        row->chars = realloc(row->chars, row->size + len + 1); // the row new size is including the null byte, +1
-        memcpy(&row->chars[row->size], s, len); // copy the given str to the end of the contents of row->chars
-        row->size += len; // update to the new length
-        row->chars[row->size] = '\0'; // terminate the str with \0
-        editorUpdateRow(row); // udpate the row's copy version & its rsize
-        E.dirty++;
+regexAST *regexCopyAST(regexAST *t){
+        if(t == NULL) return NULL;
+        regexAST *c = regexNewAST(t->type, regexCopyAST(t->a), regexCopyAST(t->b));
+        memcpy(c->set, t->set, sizeof(c->set));
+        return c;
 }
 
+int regexSizeAST(regexAST *t){
+        return t ? 1 + regexSizeAST(t->a) + regexSizeAST(t->b) : 0;
+}
 
-// function converting render index into chars index before assigning it to E.cx
-int editorRowRxToCx(erow *row, int rx){
-        int cur_rx = 0;
-        int cx;
-        for(cx = 0; cx < row->size; cx++){ // go through each char in a row
-                if(row->chars[cx] == '\t'){ // if it's tab
-                        cur_rx += (ONREE_TAB_STOP - 1) - (cur_rx % ONREE_TAB_STOP); // adjust cur_rx to account for the width of the tab. Calculate the spaces needed to reach the next tab
+// add the bytes of \d \w \s to set, returns 0 for any other letter
+int regexParseClassEscape(char c, unsigned char *set){
+        for(int b = 0; b < 256; b++){
+                int in;
+                switch(c){
+                        case 'd': case 'D': in = isdigit(b) != 0; break;
+                        case 'w': case 'W': in = isalnum(b) || b == '_'; break;
+                        case 's': case 'S': in = isspace(b) != 0; break;
+                        default: return 0;
                 }
-                cur_rx++;
-
-                if(cur_rx > rx) return cx; // return the current position in the char array of the row when hit the tab 
+                if(isupper((unsigned char)c)) in = !in; // \D is everything \d isn't
+                if(in) set[b / 8] |= 1 << (b % 8);
         }
-        return cx;
+        return 1;
 }
 
-
-/***** Editor Operations *****/
-/* This func take a char and use editorRowInsertChar() to insert that character into the position that the cursor is at
- editorInsertChar() doesn’t have to worry about the details of modifying an erow, 
- and editorRowInsertChar() doesn’t have to worry about where the cursor is.
-*/
-void editorInsertChar(int c){
-        if (E.cy == E.numrows) { // if the cursor is at the end of the current row, a new empty row will be appended
-                editorInsertRow(E.numrows, "", 0);
+// alternation: concat | concat | ...
+regexAST *regexParseAlt(const char **p, char **err){
+        regexAST *t = regexParseConcat(p, err);
+        while(t && **p == '|'){
+                (*p)++;
+                regexAST *b = regexParseConcat(p, err);
+                if(b == NULL){
+                        regexFreeAST(t);
+                        return NULL;
+                }
+                t = regexNewAST(RA_ALT, t, b);
         }
-        editorRowInsertChar(&E.row[E.cy], E.cx, c); // else insert a char at a specify location
-        E.cx++;
+        return t;
 }
 
-
-// also handle the case where the cursor is at the begining of a line
-void editorDelChar(){
-        if(E.cy == E.numrows) return; // if the cursor past the ned of the file, there's nothing to delelte. Return immediately
-        if(E.cx == 0 && E.cy == 0) return; // if the cursor is at the begining of the first line, there's nothing to do, return immediately
-
-        erow *row = &E.row[E.cy]; // else get the row the cursor is currently on
-        if(E.cx > 0){ // if there's no char to the left, the cursor at begining of the
-                editorRowDelChar(row, E.cx - 1); // delete it and move cursor  1 to the left
-                E.cx--;
-        }
-        else{ // else E.cx == 0
-                E.cx = E.row[E.cy - 1].size; // set cursor hori. position to the end of the previous line
-                editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-                editorDelRow(E.cy);
-                E.cy--;
+regexAST *regexParseConcat(const char **p, char **err){
+        regexAST *t = regexNewAST(RA_EMPTY, NULL, NULL);
+        while(**p && **p != '|' && **p != ')'){
+                regexAST *b = regexParseRepeat(p, err);
+                if(b == NULL){
+                        regexFreeAST(t);
+                        return NULL;
+                }
+                t = regexNewAST(RA_CAT, t, b);
         }
+        return t;
 }
 
+// an atom followed by any number of * + ? {m,n}
+regexAST *regexParseRepeat(const char **p, char **err){
+        regexAST *t = regexParseAtom(p, err);
+        while(t){
+                char c = **p;
+                if(c == '*' || c == '+' || c == '?'){
+                        (*p)++;
+                        t = regexNewAST(c == '*' ? RA_STAR : c == '+' ? RA_PLUS : RA_QUEST, t, NULL);
+                }
+                else if(c == '{' && isdigit((unsigned char)(*p)[1])){
+                        // x{m,n} is m copies of x followed by n - m copies of x?, x{m,} ends with x* instead
+                        char *end;
+                        long m = strtol(*p + 1, &end, 10), n = m;
+                        if(*end == ','){
+                                end++;
+                                n = isdigit((unsigned char)*end) ? strtol(end, &end, 10) : -1;
+                        }
+                        if(*end != '}' || (n != -1 && n < m) || m > 1000 || n > 1000){
+                                *err = strdup("bad {m,n}");
+                                regexFreeAST(t);
+                                return NULL;
+                        }
+                        if(((n == -1 ? m : n) + 1) * regexSizeAST(t) > REGEX_MAX_NODES){ // don't make the copies just to refuse them later
+                                *err = strdup("too big");
+                                regexFreeAST(t);
+                                return NULL;
+                        }
+                        *p = end + 1;
+                        regexAST *r = regexNewAST(RA_EMPTY, NULL, NULL);
+                        for(long i = 0; i < m; i++) r = regexNewAST(RA_CAT, r, regexCopyAST(t));
+                        if(n == -1) r = regexNewAST(RA_CAT, r, regexNewAST(RA_STAR, regexCopyAST(t), NULL));
+                        for(long i = m; i < n; i++) r = regexNewAST(RA_CAT, r, regexNewAST(RA_QUEST, regexCopyAST(t), NULL));
+                        regexFreeAST(t);
+                        t = r;
+                }
+                else break;
+        }
+        return t;
+}
 
-void editorInsertNewLine(){
-        if(E.cx == 0){ // if at begining of the line, insert a new blank row before the line currently on
-                editorInsertRow(E.cy, "", 0); 
+regexAST *regexParseAtom(const char **p, char **err){
+        char c = *(*p)++;
+        regexAST *t;
+        switch(c){
+                case '(':
+                        t = regexParseAlt(p, err);
+                        if(t && **p != ')'){
+                                *err = strdup("missing )");
+                                regexFreeAST(t);
+                                return NULL;
+                        }
+                        if(t) (*p)++;
+                        return t;
+                case '^': return regexNewAST(RA_BOL, NULL, NULL);
+                case '$': return regexNewAST(RA_EOL, NULL, NULL);
+                case '*': case '+': case '?':
+                        *err = strdup("nothing to repeat");
+                        return NULL;
         }
-        else{ // else split the lien currenlty on into rows
-                erow *row = &E.row[E.cy];
-                // pass the chars on the current row that are to the right of the cursor. It will create a new row after the current one containing the chars to the right of the curso
-                editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx); 
-                row = &E.row[E.cy]; // update the current row to contain only the chars to the left of the curso
-                row->size = E.cx; // set the size of the current row to the curso
-                row->chars[row->size] = '\0';
-                editorUpdateRow(row); // update the copy of the current row
+        t = regexNewAST(RA_SET, NULL, NULL);
+        if(c == '.'){
+                memset(t->set, 0xff, sizeof(t->set));
         }
-        E.cy++; // move to the next row
-        E.cx = 0;
+        else if(c == '\\'){
+                c = *(*p)++;
+                if(c == '\0'){
+                        *err = strdup("trailing \\");
+                        regexFreeAST(t);
+                        return NULL;
+                }
+                if(!regexParseClassEscape(c, t->set)){
+                        if(c == 't') c = '\t';
+                        t->set[(unsigned char)c / 8] |= 1 << ((unsigned char)c % 8);
+                }
+        }
+        else if(c == '['){
+                int negate = **p == '^';
+                if(negate) (*p)++;
+                int first = 1;
+                while(**p && (**p != ']' || first)){ // a ] right after [ is a literal ]
+                        first = 0;
+                        unsigned char lo = *(*p)++;
+                        if(lo == '\\' && **p){
+                                if(regexParseClassEscape(**p, t->set)){
+                                        (*p)++;
+                                        continue;
+                                }
+                                lo = *(*p)++;
+                                if(lo == 't') lo = '\t';
+                        }
+                        unsigned char hi = lo;
+                        if((*p)[0] == '-' && (*p)[1] && (*p)[1] != ']'){ // a range like a-z
+                                hi = (*p)[1];
+                                *p += 2;
+                        }
+                        for(int b = lo; b <= hi; b++) t->set[b / 8] |= 1 << (b % 8);
+                }
+                if(**p != ']'){
+                        *err = strdup("missing ]");
+                        regexFreeAST(t);
+                        return NULL;
+                }
+                (*p)++;
+                if(negate) for(int i = 0; i < 32; i++) t->set[i] = ~t->set[i];
+        }
+        else{
+                t->set[(unsigned char)c / 8] |= 1 << ((unsigned char)c % 8);
+        }
+        return t;
 }
 
-/*** syntax highlighting ***/
-void editorUpdateSyntax(erow *row){
-        row->hl = realloc(row->hl, row->size); // this might be the new row or the row might be bigger then the last time highlighted. hl array is the same as render array, so use rsize as the amoutn of memory to allocate for hl
-        memset(row->hl, HL_NORMAL, row->size);
+int regexNewNode(regex *re, int type, int out, int out1){
+        if(re->n == re->cap){
+                re->cap = re->cap ? re->cap * 2 : 64;
+                re->nodes = realloc(re->nodes, re->cap * sizeof(regexNode));
+        }
+        regexNode *n = &re->nodes[re->n];
+        n->type = type;
+        n->out = out;
+        n->out1 = out1;
+        memset(n->set, 0, sizeof(n->set));
+        return re->n++;
+}
 
-        if(E.syntax == NULL) return; // rturn immediately after memset()ting the entire line to HL_NORMAL.
+/* Compile t so that it continues to node next, returns where t starts. The reversed NFA matches the text backwards:
+its concatenations go right to left and ^ & $ trade places, since reading backwards a line starts at its end */
+int regexCompileAST(regex *re, regexAST *t, int next, int reverse){
+        if(re->n > REGEX_MAX_NODES) return next; // too big, regexCompile() gives up
+        int s, body;
+        switch(t->type){
+                case RA_SET:
+                        s = regexNewNode(re, RE_CHAR, next, -1);
+                        memcpy(re->nodes[s].set, t->set, sizeof(t->set));
+                        return s;
+                case RA_CAT:
+                        if(reverse) return regexCompileAST(re, t->b, regexCompileAST(re, t->a, next, reverse), reverse);
+                        return regexCompileAST(re, t->a, regexCompileAST(re, t->b, next, reverse), reverse);
+                case RA_ALT:
+                        body = regexCompileAST(re, t->a, next, reverse);
+                        return regexNewNode(re, RE_SPLIT, body, regexCompileAST(re, t->b, next, reverse));
+                case RA_QUEST:
+                        return regexNewNode(re, RE_SPLIT, regexCompileAST(re, t->a, next, reverse), next);
+                case RA_STAR: case RA_PLUS:
+                        s = regexNewNode(re, RE_SPLIT, -1, next); // loop back or go on
+                        body = regexCompileAST(re, t->a, s, reverse);
+                        re->nodes[s].out = body;
+                        return t->type == RA_STAR ? s : body;
+                case RA_BOL: case RA_EOL:
+                        return regexNewNode(re, (t->type == RA_BOL) != reverse ? RE_BOL : RE_EOL, next, -1);
+        }
+        return next; // RA_EMPTY
+}
 
-        char **keywords = E.syntax->keywords;
+regex *regexCompile(const char *pattern, char **err){
+        static int ids = 0;
+        const char *p = pattern;
+        *err = NULL;
+        regexAST *t = regexParseAlt(&p, err);
+        if(t && *p == ')'){
+                *err = strdup("unmatched )");
+                regexFreeAST(t);
+                return NULL;
+        }
+        if(t == NULL) return NULL;
+
+        regex *re = calloc(1, sizeof(regex));
+        for(int reverse = 0; reverse < 2; reverse++) re->start[reverse] = regexCompileAST(re, t, regexNewNode(re, RE_MATCH, -1, -1), reverse);
+        regexFreeAST(t);
+        if(re->n > REGEX_MAX_NODES){
+                *err = strdup("too big");
+                regexFree(re);
+                return NULL;
+        }
+        re->id = ++ids;
+        return re;
+}
 
-        char *scs = E.syntax->singleline_comment_start;
-        char *mcs = E.syntax->multiline_comment_start;
-        char *mce = E.syntax->multiline_comment_end;
+void regexFree(regex *re){
+        if(re == NULL) return;
+        free(re->nodes);
+        free(re);
+}
 
-        int scs_len = scs ? strlen(scs) : 0;
-        int mcs_len = mcs ? strlen(mcs) : 0;
-        int mce_len = mce ? strlen(mce) : 0;
+regexDFA *regexNewDFA(regex *re, int reverse, int unanchored){
+        regexDFA *d = calloc(1, sizeof(regexDFA));
+        d->re = re;
+        d->id = re->id;
+        d->reverse = reverse;
+        d->unanchored = unanchored;
+        d->next = malloc((size_t)REGEX_DFA_STATES * 256 * sizeof(int));
+        d->flags = malloc(REGEX_DFA_STATES);
+        d->setoff = malloc(REGEX_DFA_STATES * sizeof(int));
+        d->setlen = malloc(REGEX_DFA_STATES * sizeof(int));
+        d->hash = malloc(REGEX_DFA_STATES * 2 * sizeof(int));
+        d->stack = malloc((re->n * 3 + 2) * sizeof(int)); // every node is pushed by at most 2 others, plus the seeds
+        d->mark = calloc(re->n, sizeof(int));
+        d->tmp = malloc((re->n + 1) * sizeof(int));
+        d->seeds = malloc((re->n + 1) * sizeof(int));
+        regexFlushDFA(d);
+        return d;
+}
 
+void regexFreeDFA(regexDFA *d){
+        if(d == NULL) return;
+        free(d->next);
+        free(d->flags);
+        free(d->setoff);
+        free(d->setlen);
+        free(d->sets);
+        free(d->hash);
+        free(d->stack);
+        free(d->mark);
+        free(d->tmp);
+        free(d->seeds);
+        free(d);
+}
 
-        int prev_sep = 1; // keep track of whether the previous char was a separator, 1 is true consider the begining of the line to be a separtor
-        int in_string = 0; // keep track of whether currently inside a string. If inside, keep highlighting the current character as a string until hit the closing quote
-        int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment); // initialize in_comment to true if the previous row has an unclosed multi-line comment. If that’s the case, then the current row will start out being highlighted as a multi-line comment.
+// forget every state, done at the start & when the DFA is full
+void regexFlushDFA(regexDFA *d){
+        d->flushes++;
+        d->nstates = 0;
+        d->setsused = 0;
+        d->startstate[0] = d->startstate[1] = -1;
+        memset(d->hash, 0, REGEX_DFA_STATES * 2 * sizeof(int));
+}
 
-        int i = 0;
-        while(i < row->size){ // go through each char in a line
-                char c = row->render[i]; // get the current char from a row
-                unsigned char prev_hl = (i > 0)? row->hl[i-1] : HL_NORMAL;
-
-                // single-line comments should not be recognized inside multi-line comments
-                if(scs_len && !in_string && !in_comment){ // check if not in a string
-                        // Compare the beginning of the current line (row->render) with the single-line comment start delimiter (scs)
-                        if(!strncmp(&row->render[i], scs, scs_len)){
-                                // &row->hl[i] - Start highlighting from the current character. row->size - 1 till the last char
-                                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+/* Put in d->tmp (d->tmp[0] is the count) the NFA nodes reachable from seeds without reading a char, sorted so equal sets compare equal.
+Only RE_CHAR, RE_EOL & RE_MATCH nodes are kept, the others only lead somewhere. RE_BOL is followed if bol, meaning at the start of a line */
+void regexClosure(regexDFA *d, int *seeds, int nseeds, int bol){
+        regexNode *nodes = d->re->nodes;
+        int sp = 0, n = 0;
+        d->markgen++;
+        for(int i = 0; i < nseeds; i++) d->stack[sp++] = seeds[i];
+        while(sp){
+                int s = d->stack[--sp];
+                if(s < 0 || d->mark[s] == d->markgen) continue;
+                d->mark[s] = d->markgen;
+                switch(nodes[s].type){
+                        case RE_SPLIT:
+                                d->stack[sp++] = nodes[s].out1;
+                                d->stack[sp++] = nodes[s].out;
                                 break;
-                        }
+                        case RE_BOL:
+                                if(bol) d->stack[sp++] = nodes[s].out;
+                                break;
+                        default:
+                                d->tmp[1 + n++] = s;
                 }
+        }
+        // insertion sort, sets are small
+        for(int i = 1; i < n; i++){
+                int v = d->tmp[1 + i], j = i;
+                while(j > 0 && d->tmp[j] > v){
+                        d->tmp[1 + j] = d->tmp[j];
+                        j--;
+                }
+                d->tmp[1 + j] = v;
+        }
+        d->tmp[0] = n;
+}
 
-                if(mcs_len && mce_len && !in_string){ // validate the start & end of comment and if it's not in a string
-                        if(in_comment){ // if inside multi-line comment
-                                row->hl[i] = HL_MLCOMMENT; // highlight the current char
-                                if(!strncmp(&row->render[i], mce, mce_len)){ // check if at the end of a multi-line
-                                        memset(&row->hl[i], HL_MLCOMMENT, mce_len); // highlight the whole mce string
-                                        i += mce_len; 
-                                        in_comment = 0;
-                                        prev_sep = 1;
-                                        continue;
-                                }
-                                else{ // if not at the end of the comment, consume the current char whici already highlighted
-                                        i++;
-                                        continue;
-                                }
+// the state for the set in d->tmp, made if it's new. The DFA is flushed when full, so other state numbers may go stale
+int regexIntern(regexDFA *d){
+        int n = d->tmp[0], *set = &d->tmp[1];
+        unsigned int h = 2166136261u;
+        for(int i = 0; i < n; i++) h = (h ^ set[i]) * 16777619u;
+        unsigned int mask = REGEX_DFA_STATES * 2 - 1;
+        for(unsigned int i = h & mask; d->hash[i]; i = (i + 1) & mask){
+                int st = d->hash[i] - 1;
+                if(d->setlen[st] == n && !memcmp(&d->sets[d->setoff[st]], set, n * sizeof(int))) return st;
+        }
+        if(d->nstates == REGEX_DFA_STATES){
+                regexFlushDFA(d);
+                return regexIntern(d);
+        }
+        int st = d->nstates++;
+        if(d->setsused + n > d->setscap){
+                d->setscap = (d->setsused + n) * 2;
+                d->sets = realloc(d->sets, d->setscap * sizeof(int));
+        }
+        d->setoff[st] = d->setsused;
+        d->setlen[st] = n;
+        memcpy(&d->sets[d->setsused], set, n * sizeof(int));
+        d->setsused += n;
+        d->flags[st] = 0;
+        for(int i = 0; i < n; i++) if(d->re->nodes[set[i]].type == RE_MATCH) d->flags[st] |= REGEX_ACCEPT;
+        for(int i = 0; i < 256; i++) d->next[st * 256 + i] = -1;
+        for(unsigned int i = h & mask; ; i = (i + 1) & mask){
+                if(d->hash[i] == 0){
+                        d->hash[i] = st + 1;
+                        break;
+                }
+        }
+        return st;
+}
+
+// the state before reading anything, bol if that's at the start of a line
+int regexStart(regexDFA *d, int bol){
+        if(d->startstate[bol] == -1){
+                regexClosure(d, &d->re->start[d->reverse], 1, bol);
+                d->startstate[bol] = regexIntern(d);
+        }
+        return d->startstate[bol];
+}
+
+int regexStep(regexDFA *d, int state, unsigned char c){
+        int next = d->next[state * 256 + c];
+        if(next >= 0) return next;
+
+        int *set = &d->sets[d->setoff[state]], n = d->setlen[state], nseeds = 0;
+        int *seeds = d->seeds;
+        for(int i = 0; i < n; i++){
+                regexNode *node = &d->re->nodes[set[i]];
+                if(node->type == RE_CHAR && (node->set[c / 8] & (1 << (c % 8)))) seeds[nseeds++] = node->out;
+        }
+        if(d->unanchored) seeds[nseeds++] = d->re->start[d->reverse]; // a match can also start after this char
+        regexClosure(d, seeds, nseeds, 0);
+        int before = d->nstates;
+        next = regexIntern(d);
+        if(d->nstates >= before) d->next[state * 256 + c] = next; // unless regexIntern() flushed, then state is gone
+        return next;
+}
+
+// does state reach RE_MATCH if the line ends here, following $
+int regexAcceptsAtEnd(regexDFA *d, int state){
+        if(!(d->flags[state] & REGEX_END_KNOWN)){
+                int *set = &d->sets[d->setoff[state]], n = d->setlen[state], nseeds = 0;
+                int *seeds = d->seeds;
+                for(int i = 0; i < n; i++){
+                        regexNode *node = &d->re->nodes[set[i]];
+                        if(node->type == RE_EOL) seeds[nseeds++] = node->out;
+                        else if(node->type == RE_MATCH) seeds[nseeds++] = set[i];
+                }
+                d->flags[state] |= REGEX_END_KNOWN;
+                d->markgen++;
+                int sp = 0;
+                for(int i = 0; i < nseeds; i++) d->stack[sp++] = seeds[i];
+                while(sp){
+                        int s = d->stack[--sp];
+                        if(s < 0 || d->mark[s] == d->markgen) continue;
+                        d->mark[s] = d->markgen;
+                        regexNode *node = &d->re->nodes[s];
+                        if(node->type == RE_MATCH){
+                                d->flags[state] |= REGEX_ACCEPT_END;
+                                break;
+                        }
+                        if(node->type == RE_SPLIT){
+                                d->stack[sp++] = node->out1;
+                                d->stack[sp++] = node->out;
+                        }
+                        else if(node->type == RE_EOL) d->stack[sp++] = node->out;
+                }
+        }
+        return (d->flags[state] & REGEX_ACCEPT_END) != 0;
+}
+
+/* Each thread keeps its DFAs for as long as the regex stays the same, so states made on one range are reused on the next.
+[0] is the forward anchored DFA, [1] the reversed unanchored one */
+regexDFA *regexThreadDFA(regex *re, int reverse){
+        static __thread regexDFA *dfa[2];
+        if(dfa[reverse] == NULL || dfa[reverse]->id != re->id){
+                regexFreeDFA(dfa[reverse]);
+                dfa[reverse] = regexNewDFA(re, reverse, reverse);
+        }
+        return dfa[reverse];
+}
+
+/* Find the leftmost-longest, non overlapping, non empty matches of re in a line. Linear in the line length:
+1. the reversed regex is run backwards over the whole line, unanchored. Where it accepts at position i, a match starts at i
+2. from each such start after the previous match, the forward regex is run to find the longest match there. A scan can go on well past the
+end of its match (a|a.*b over aaaa... runs to the end of the line from every a), so every position a scan went through is kept with the state
+it was in there & the last position it accepted from there on. A later scan that gets to a position in a state already seen there would do
+exactly the same from then on, so it takes that result & stops. Each position is scanned at most once per DFA state */
+void regexSearchLine(regex *re, const char *s, int len, int row, searchRange *r){
+        static __thread unsigned char *starts;
+        static __thread int *head, *path, startscap;
+        static __thread regexSeen *seen;
+        static __thread int seencap;
+        if(len + 1 > startscap){
+                startscap = (len + 1) * 2;
+                starts = realloc(starts, startscap);
+                head = realloc(head, startscap * sizeof(int));
+                path = realloc(path, startscap * sizeof(int));
+        }
+
+        regexDFA *rev = regexThreadDFA(re, 1);
+        int st = regexStart(rev, 1), any = 0; // the end of the line is where the reversed regex starts reading
+        for(int i = len; i >= 0; i--){
+                starts[i] = (rev->flags[st] & REGEX_ACCEPT) || (i == 0 && regexAcceptsAtEnd(rev, st));
+                any |= starts[i];
+                if(i > 0) st = regexStep(rev, st, s[i - 1]);
+        }
+        if(!any) return;
+
+        regexDFA *fwd = regexThreadDFA(re, 0);
+        int nseen = 0, flushes = -1;
+        for(int i = 0; i < len; i++){
+                if(!starts[i]) continue;
+                int end = -1, from = i, j;
+                st = regexStart(fwd, i == 0);
+                for(j = i; ; j++){
+                        if(fwd->flushes != flushes){ // state numbers changed, what was seen is no use any more
+                                for(int k = 0; k <= len; k++) head[k] = -1;
+                                nseen = 0;
+                                flushes = fwd->flushes;
+                                from = j;
+                        }
+                        int k = head[j];
+                        while(k >= 0 && seen[k].state != st) k = seen[k].next;
+                        if(k >= 0){ // an earlier scan went on from here
+                                if(seen[k].last > end) end = seen[k].last;
+                                break;
+                        }
+                        path[j] = st;
+                        if((fwd->flags[st] & REGEX_ACCEPT) || (j == len && regexAcceptsAtEnd(fwd, st))) end = j;
+                        if(j == len || fwd->setlen[st] == 0){ // end of the line, or no match can go on from here
+                                j++;
+                                break;
+                        }
+                        st = regexStep(fwd, st, s[j]);
+                }
+
+                // the positions this scan went through, with the last accept from each on
+                if(nseen + (j - from) > seencap){
+                        seencap = (nseen + (j - from)) * 2;
+                        seen = realloc(seen, seencap * sizeof(regexSeen));
+                }
+                int last = end > j - 1 ? end : -1; // accepted after the last position kept
+                for(int k = j - 1; k >= from; k--){
+                        if(last == -1 && ((fwd->flags[path[k]] & REGEX_ACCEPT) || (k == len && regexAcceptsAtEnd(fwd, path[k])))) last = k;
+                        seen[nseen] = (regexSeen){path[k], last, head[k]};
+                        head[k] = nseen++;
+                }
+
+                if(end > i){
+                        searchRangePush(r, row, i, end - i);
+                        i = end - 1; // the next match starts after this one
+                }
+        }
+}
+
+
+/***** Row Allocator *****/
+// the smallest class that holds size bytes, ROW_CLASSES if it's too big for one
+int rowClass(size_t size){
+        int c = 0;
+        while(c < ROW_CLASSES && (size_t)ROW_CLASS_SIZE[c] < size) c++;
+        return c;
+}
+
+// a block of at least size bytes, *cap is set to its real size. That's what's given to rowFree() & rowGrow()
+void *rowAlloc(size_t size, int *cap){
+        ARENA.blocks++;
+        int c = rowClass(size);
+        if(c == ROW_CLASSES){
+                size = (size + 15) & ~(size_t)15;
+                rowBig *b = malloc(sizeof(rowBig) + size);
+                ARENA.mallocs++;
+                b->prev = NULL;
+                b->next = ARENA.big;
+                if(ARENA.big) ARENA.big->prev = b;
+                ARENA.big = b;
+                *cap = size;
+                return b + 1;
+        }
+
+        *cap = ROW_CLASS_SIZE[c];
+        void *p = ARENA.free[c];
+        if(p){
+                ARENA.free[c] = *(void **)p;
+                return p;
+        }
+        if(ARENA.end - ARENA.next < *cap){ // the slab is used up, what's left of it goes to the free lists of the classes that fit
+                while(ARENA.end - ARENA.next >= ROW_CLASS_SIZE[0]){
+                        int k = ROW_CLASSES - 1;
+                        while(ROW_CLASS_SIZE[k] > ARENA.end - ARENA.next) k--;
+                        *(void **)ARENA.next = ARENA.free[k];
+                        ARENA.free[k] = ARENA.next;
+                        ARENA.next += ROW_CLASS_SIZE[k];
+                }
+                rowSlab *s = mmap(NULL, ROW_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); // straight from the OS, so it goes back when released
+                if(s == MAP_FAILED) die("mmap");
+                ARENA.mallocs++;
+                s->next = ARENA.slabs;
+                ARENA.slabs = s;
+                ARENA.next = (char *)(s + 1);
+                ARENA.end = (char *)s + ROW_SLAB_SIZE;
+        }
+        p = ARENA.next;
+        ARENA.next += *cap;
+        return p;
+}
+
+void rowFree(void *p, int cap){
+        if(p == NULL) return;
+        if(cap > ROW_CLASS_MAX){
+                rowBig *b = (rowBig *)p - 1;
+                if(b->prev) b->prev->next = b->next;
+                else ARENA.big = b->next;
+                if(b->next) b->next->prev = b->prev;
+                free(b);
+                return;
+        }
+        int c = rowClass(cap);
+        *(void **)p = ARENA.free[c];
+        ARENA.free[c] = p;
+}
+
+/* make the block at p, *cap bytes with the first used of them in use, hold at least size bytes. Most of the time it does already.
+Otherwise it's swapped for a block of the next class that fits, or one with half as much again to spare for a big one, so a row growing
+a char at a time is copied every ~1.5x of its size */
+void *rowGrow(void *p, int *cap, int used, size_t size){
+        if(p && size <= (size_t)*cap){
+                ARENA.grown++;
+                return p;
+        }
+        if(size > ROW_CLASS_MAX) size += size / 2;
+        int newcap;
+        void *q = rowAlloc(size, &newcap);
+        if(used > 0) memcpy(q, p, used);
+        rowFree(p, *cap);
+        *cap = newcap;
+        return q;
+}
+
+// give back every slab & big block, every row is gone after this
+void rowAllocRelease(){
+        while(ARENA.slabs){
+                rowSlab *s = ARENA.slabs;
+                ARENA.slabs = s->next;
+                munmap(s, ROW_SLAB_SIZE);
+        }
+        while(ARENA.big){
+                rowBig *b = ARENA.big;
+                ARENA.big = b->next;
+                free(b);
+        }
+        memset(ARENA.free, 0, sizeof(ARENA.free));
+        ARENA.next = ARENA.end = NULL;
+}
+
+
+/***** Row Storage *****/
+/* The tree is only ever reshaped by rowSplit() and rowMerge(). Splitting cuts the tree into the first k rows and the rest,
+merging glues two trees back together in order. Inserting or deleting a row is a couple of splits and merges, each O(log n) 
+
+A node is either a loaded row (fileline is -1, row holds the text) or a run of nlines lines of the opened file that haven't been
+displayed or edited yet (fileline is the first of them, the text is still only in E.map). Runs are turned into loaded rows one row at a time */
+rowNode *rowNodeOf(erow *row){
+        return (rowNode *)((char *)row - offsetof(rowNode, row)); // the erow is embedded in its node, step back to the start of the node
+}
+
+int rowCount(rowNode *n){
+        return n ? n->count : 0;
+}
+
+// recompute count & fix the parent pointers of the children after a node's children changed
+void rowNodeUpdate(rowNode *n){
+        n->count = rowCount(n->left) + rowCount(n->right) + n->nlines;
+        if(n->left) n->left->parent = n;
+        if(n->right) n->right->parent = n;
+}
+
+unsigned int rowRandom(){
+        static unsigned int seed = 2463534242u; // xorshift, fixed seed so the tree shape is the same on every run
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+}
+
+rowNode *rowNewNode(int fileline, int nlines){
+        int cap;
+        rowNode *n = rowAlloc(sizeof(rowNode), &cap); // a node is always sizeof(rowNode), so cap isn't kept
+        n->left = n->right = n->parent = NULL;
+        n->prio = rowRandom();
+        n->nlines = nlines;
+        n->count = nlines;
+        n->fileline = fileline;
+        return n;
+}
+
+// split tree t so that *l gets its first k rows and *r gets the rest. k must fall on a node boundary, see rowCut()
+void rowSplit(rowNode *t, int k, rowNode **l, rowNode **r){
+        if(t == NULL){
+                *l = *r = NULL;
+                return;
+        }
+        if(k <= rowCount(t->left)){ // cut point is inside the left subtree
+                rowSplit(t->left, k, l, &t->left);
+                *r = t;
+        }
+        else{
+                rowSplit(t->right, k - rowCount(t->left) - t->nlines, &t->right, r);
+                *l = t;
+        }
+        rowNodeUpdate(t);
+}
+
+// join tree a followed by tree b, the node with the higher priority becomes the root
+rowNode *rowMerge(rowNode *a, rowNode *b){
+        if(a == NULL) return b;
+        if(b == NULL) return a;
+        if(a->prio > b->prio){
+                a->right = rowMerge(a->right, b);
+                rowNodeUpdate(a);
+                return a;
+        }
+        b->left = rowMerge(a, b->left);
+        rowNodeUpdate(b);
+        return b;
+}
+
+void rowSetRoot(rowNode *root){
+        if(root) root->parent = NULL;
+        E.rows = root;
+}
+
+void rowFreeTree(rowNode *n){
+        if(n == NULL) return;
+        rowFreeTree(n->left);
+        rowFreeTree(n->right);
+        if(n->fileline == -1) editorFreeRow(&n->row);
+        rowFree(n, sizeof(rowNode));
+}
+
+// find the node holding row at, *off is set to how far into the node the row is (always 0 for a loaded row)
+rowNode *rowFind(int at, int *off){
+        rowNode *n = E.rows;
+        while(n){
+                int lc = rowCount(n->left);
+                if(at < lc){
+                        n = n->left;
+                }
+                else if(at < lc + n->nlines){
+                        *off = at - lc;
+                        return n;
+                }
+                else{
+                        at -= lc + n->nlines; // skip the left subtree and this node
+                        n = n->right;
+                }
+        }
+        return NULL;
+}
+
+// index of the first row held by node n, worked out by climbing to the root and counting the rows to the left
+int rowNodeIndex(rowNode *n){
+        int idx = rowCount(n->left);
+        while(n->parent){
+                if(n == n->parent->right) idx += rowCount(n->parent->left) + n->parent->nlines;
+                n = n->parent;
+        }
+        return idx;
+}
+
+rowNode *rowNodeNext(rowNode *n){
+        if(n->right){ // leftmost node of the right subtree
+                n = n->right;
+                while(n->left) n = n->left;
+                return n;
+        }
+        while(n->parent && n == n->parent->right) n = n->parent; // climb until coming up from a left child
+        return n->parent;
+}
+
+rowNode *rowNodePrev(rowNode *n){
+        if(n->left){ // rightmost node of the left subtree
+                n = n->left;
+                while(n->right) n = n->right;
+                return n;
+        }
+        while(n->parent && n == n->parent->left) n = n->parent;
+        return n->parent;
+}
+
+/* make sure a node starts exactly at row at, so the tree can be split there. If at falls inside a run, the run is cut in two.
+Returns the node starting at row at, NULL when at is past the last row */
+rowNode *rowCut(int at){
+        int off;
+        rowNode *n = rowFind(at, &off);
+        if(n == NULL || off == 0) return n;
+
+        rowNode *l, *mid, *r;
+        int start = at - off;
+        rowSplit(E.rows, start, &l, &r); // take the run out of the tree
+        rowSplit(r, n->nlines, &mid, &r);
+
+        rowNode *tail = rowNewNode(n->fileline + off, n->nlines - off); // second half of the run
+        n->nlines = off;
+        n->left = n->right = NULL;
+        rowNodeUpdate(n);
+        rowSetRoot(rowMerge(rowMerge(rowMerge(l, n), tail), r));
+        return tail;
+}
+
+// text of line number line of the mapped file, without its line ending
+char *rowFileLine(int line, int *len){
+        size_t start = E.lineoff[line];
+        size_t end = E.lineoff[line + 1];
+        if(end > start && E.map[end - 1] == '\n'){
+                end--;
+                if(end > start && E.map[end - 1] == '\r') end--; // \r\n line ending, a \r without a \n after it is part of the text
+        }
+        *len = end - start;
+        return &E.map[start];
+}
+
+void rowInit(erow *row, char *s, size_t len){
+        row->longrow = 0;
+        if(len > ROW_LONG){ // cut into chunks straight away, see Long Rows
+                rowLongBuild(row, s, len);
+        }
+        else{
+                row->size = len; // update the size of the current row
+                row->chars = rowAlloc(len + 1, &row->charcap); // allocate memory, usually a bit more than len + 1: typing into the row fills that first
+                memcpy(row->chars, s, len); // copy the str to newly allocated memory
+                row->chars[len] = '\0'; // make the end of a st
+        }
+        
+        row->rsize = 0;
+        row->render = NULL;
+        row->hl = NULL;
+        row->nhl = -1;
+        row->rendercap = 0;
+        row->hl_open_comment = 0;
+        row->cache_prev = row->cache_next = NULL;
+        row->tabs = NULL;
+        row->ntabs = -1;
+        row->tabcap = row->tabvalid = 0;
+}
+
+// turn row at into a loaded row, copying its text out of the mapped file
+erow *rowLoad(int at){
+        rowNode *n = rowCut(at);
+        if(n->nlines > 1) rowCut(at + 1); // leave the rest of the run after it as its own run
+
+        int len, line = n->fileline;
+        char *s = rowFileLine(line, &len);
+        n->fileline = -1;
+        rowInit(&n->row, s, len);
+        n->row.hl_open_comment = E.hlstate[line]; // the state it had in the file, so the rows below are only redone if loading it changes that
+        editorUpdateRow(&n->row);
+        return &n->row;
+}
+
+// return row at (0-indexed), NULL if there's no such row. Rows still in the mapped file are loaded here, when they are displayed or edited
+erow *editorRowAt(int at){
+        if(at < 0 || at >= E.numrows) return NULL;
+        int off;
+        rowNode *n = rowFind(at, &off);
+        if(n->fileline == -1) return &n->row;
+        return rowLoad(at); // only this row, the state it starts in is read from the line above wherever it is, see editorSyntaxStart()
+}
+
+// row right after row in the file, NULL at the end. Walking every row this way is O(1) per row on average
+erow *editorRowNext(erow *row){
+        rowNode *n = rowNodeNext(rowNodeOf(row));
+        if(n == NULL) return NULL;
+        if(n->fileline == -1) return &n->row;
+        return rowLoad(rowNodeIndex(n)); // first line of a run
+}
+
+erow *editorRowPrev(erow *row){
+        rowNode *n = rowNodePrev(rowNodeOf(row));
+        if(n == NULL) return NULL;
+        if(n->fileline == -1) return &n->row;
+        return editorRowAt(rowNodeIndex(n) + n->nlines - 1); // last line of a run
+}
+
+// each row's index within the file
+int editorRowIndex(erow *row){
+        return rowNodeIndex(rowNodeOf(row));
+}
+
+/* Row positions walk through the file row by row without loading anything, for code that only needs to read the text of every row
+(saving, searching). The text is either the chars of a loaded row or a line straight out of the mapped file */
+void rowPosAt(rowPos *p, int at){
+        p->line = 0;
+        p->node = rowFind(at, &p->line);
+}
+
+int rowPosNext(rowPos *p){
+        if(++p->line < p->node->nlines) return 1;
+        p->node = rowNodeNext(p->node);
+        p->line = 0;
+        return p->node != NULL;
+}
+
+int rowPosPrev(rowPos *p){
+        if(--p->line >= 0) return 1;
+        p->node = rowNodePrev(p->node);
+        if(p->node) p->line = p->node->nlines - 1;
+        return p->node != NULL;
+}
+
+char *rowPosText(rowPos *p, int *len){
+        if(p->node->fileline == -1){
+                erow *row = &p->node->row;
+                *len = row->size;
+                if(row->longrow){ // a row in chunks is copied out in one piece, into a buffer the next call reuses
+                        static char *buf = NULL;
+                        static int bufsize = 0;
+                        if(row->size + 1 > bufsize){
+                                bufsize = row->size + 1;
+                                buf = realloc(buf, bufsize);
+                        }
+                        rowCopy(row, 0, row->size, buf);
+                        buf[row->size] = '\0';
+                        return buf;
+                }
+                return row->chars;
+        }
+        return rowFileLine(p->node->fileline + p->line, len);
+}
+
+
+/***** Row Operation *****/
+/* This function allocate space for a new erow, and then copy the given str to a new erow.
+It will now be able to insert a row at the index specified by the new at argument. */
+void editorInsertRow(int at, char *s, size_t len){
+        if(at < 0 || at > E.numrows) return;
+
+        rowNode *node = rowNewNode(-1, 1); // the node holds the new erow
+        erow *row = &node->row;
+        rowInit(row, s, len);
+
+        rowNode *l, *r;
+        rowCut(at); // in case at is in the middle of a run of unloaded lines
+        rowSplit(E.rows, at, &l, &r); // cut the tree at the insert position and put the new node in between
+        rowSetRoot(rowMerge(rowMerge(l, node), r));
+        E.numrows++; // update the newly row, reprent 1 row with text
+
+        editorSyntaxShift(at, 1);
+        editorUpdateRow(row);
+        editorSyntaxMark(at + 1); // the row below used to start after a different row
+        E.dirty++; // incremnet bc make changes to text
+}
+
+/* called whenever the chars of a row change. render & hl are only a cache of what the row looks like on screen,
+so they are thrown away here and built again by editorRowRender() the next time the row is drawn */
+void editorUpdateRow(erow *row) {
+        long start = statNow();
+        rowTabsReset(row); // built again when it's needed
+        editorRowDropRender(row);
+        editorUpdateSyntax(row); // the multi-line comment state is still worked out right away
+        statAdd(STAT_UPDATEROW, start);
+}
+
+/***** Render Cache *****/
+/* Rows with a render & hl are kept in a list, most recently drawn first. When more than E.cachemax rows have one,
+the rows drawn longest ago (far away from what's on screen) lose theirs */
+void editorRowDropRender(erow *row){
+        if(row->render == NULL) return;
+        if(row->rendercap) rowFree(row->render, row->rendercap); // else render is chars, nothing to free
+        editorRowDropHighlight(row);
+        row->render = NULL;
+        row->rsize = 0;
+
+        // unlink from the list
+        if(row->cache_prev) row->cache_prev->cache_next = row->cache_next;
+        else E.cache_head = row->cache_next;
+        if(row->cache_next) row->cache_next->cache_prev = row->cache_prev;
+        else E.cache_tail = row->cache_prev;
+        row->cache_prev = row->cache_next = NULL;
+        E.cached--;
+}
+
+// make sure row has its render & hl, and move it to the front of the list. Anything that reads render, rsize or hl calls this first
+erow *editorRowRender(erow *row){
+        if(row->longrow) return row; // drawn a chunk at a time, nothing is kept, see Long Rows
+        if(row->render == NULL){
+                editorRowBuildRender(row);
+                E.cached++;
+                while(E.cached > E.cachemax && E.cache_tail != row) editorRowDropRender(E.cache_tail);
+        }
+        else if(row != E.cache_head){ // unlink, it goes back in at the front below
+                row->cache_prev->cache_next = row->cache_next;
+                if(row->cache_next) row->cache_next->cache_prev = row->cache_prev;
+                else E.cache_tail = row->cache_prev;
+        }
+        else{
+                if(row->nhl == -1) editorRowBuildHighlight(row);
+                return row;
+        }
+
+        row->cache_prev = NULL;
+        row->cache_next = E.cache_head;
+        if(E.cache_head) E.cache_head->cache_prev = row;
+        E.cache_head = row;
+        if(E.cache_tail == NULL) E.cache_tail = row;
+
+        if(row->nhl == -1) editorRowBuildHighlight(row);
+        return row;
+}
+
+/* highlight the rendered row, starting in the state the row above ended in. The row is highlighted a byte per char into a scratch buffer,
+which is then turned into the runs the row keeps */
+void editorRowBuildHighlight(erow *row){
+        static unsigned char *scratch = NULL;
+        static hlSpan *spans = NULL;
+        static int scratch_size = 0;
+        if(row->rsize + 1 > scratch_size){
+                scratch_size = row->rsize * 2 + 64;
+                scratch = realloc(scratch, scratch_size);
+                spans = realloc(spans, scratch_size * sizeof(hlSpan));
+        }
+
+        int in_comment = 0;
+        if(E.syntax){
+                editorSyntaxKnow(editorRowIndex(row)); // the rows above it need their state first
+                in_comment = editorSyntaxStart(row);
+        }
+        editorHighlightLine(row->render, row->rsize, scratch, in_comment);
+
+        int end = row->rsize;
+        while(end > 0 && scratch[end - 1] == HL_NORMAL) end--; // the HL_NORMAL chars at the end need no run
+        int n = 0;
+        for(int i = 0; i < end; ){
+                int j = i + 1;
+                while(j < end && j - i < HL_SPAN_MAX && scratch[j] == scratch[i]) j++;
+                spans[n].len = j - i;
+                spans[n].hl = scratch[i];
+                n++;
+                i = j;
+        }
+        int cap;
+        row->hl = n ? rowAlloc(n * sizeof(hlSpan), &cap) : NULL; // freed with its size, so cap isn't kept
+        if(n) memcpy(row->hl, spans, n * sizeof(hlSpan));
+        row->nhl = n;
+}
+
+// throw the highlighting away, it's built again when the row is drawn
+void editorRowDropHighlight(erow *row){
+        if(row->hl) rowFree(row->hl, row->nhl * sizeof(hlSpan));
+        row->hl = NULL;
+        row->nhl = -1;
+}
+
+/* this function uses the chars str of an erow to fill in the contents of the render str. Only tabs look different on screen than in chars,
+control chars are swapped for their symbols while drawing, so a row without tabs is drawn straight from chars */
+void editorRowBuildRender(erow *row) {
+        int tabs = 0;
+        int j;
+        char *p = row->chars, *end = row->chars + row->size;
+        while((p = memchr(p, '\t', end - p)) != NULL){ // count the tabs in order to know how much memory to allocate for rende
+                tabs++;
+                p++;
+        }
+        if(tabs == 0){
+                row->render = row->chars;
+                row->rendercap = 0;
+                row->rsize = row->size;
+                return;
+        }
+
+        row->render = rowAlloc(row->size + tabs*(ONREE_TAB_STOP - 1) + 1, &row->rendercap); // allocate mem with tabs
+        
+        int idx = 0;
+        for (j = 0; j < row->size; j++) {
+                if(row->chars[j] == '\t'){ // if the current char is a tab, append one space bc each tab must advance the cursor forward at least 1 col
+                        row->render[idx++] = ' ';
+                        while(idx % ONREE_TAB_STOP != 0) row->render[idx++] = ' ';// then apppend spaces til get to the tab stop, which is a col that divisible by 8
+                }
+                else{
+                        row->render[idx++] = row->chars[j]; // copy each char to rende
+                }
+        }
+        row->render[idx] = '\0';
+        row->rsize = idx; // update the size of row
+}
+
+// function that converts a chars index into a render index: the render index right after the last tab before cx, plus the chars after that tab
+int editorRowCxToRx(erow *row, int cx){
+        if(row->longrow) return rowLongCxToRx(rowLongOf(row), cx);
+        tabStop *tabs = rowTabs(row);
+        int k = rowTabsBefore(row, cx);
+        if(k == 0) return cx; // no tabs before cx, every char is one col
+        return tabs[k - 1].rxend + (cx - tabs[k - 1].cx - 1);
+}
+
+// the same by going through the row from the start, what editorRowCxToRx() did before the tab index. Kept for --bench-tabs
+int editorRowCxToRxLinear(erow *row, int cx){
+        int rx = 0;
+        int j;
+        for (j = 0; j < cx; j++) { // loop through all the chars to the left fo cx
+                if (row->chars[j] == '\t') {// if it's a tab
+                /* use rx % KILO_TAB_STOP to find out how many columns we are to the right of the last tab stop, 
+                then subtract that from KILO_TAB_STOP - 1 to find out how many columns we are to the left of the next tab stop
+                Add that amount to rx to get just to the left of the next tab stop,*/
+                        rx += (ONREE_TAB_STOP - 1) - (rx % ONREE_TAB_STOP);
+                }
+                rx++; // to get right on the next tab stop
+        }
+        return rx;
+}
+
+// function that inserts a single character into an erow, at a given position.
+void editorRowInsertChar(erow *row, int at, int c){
+        if (at < 0 || at > row->size) at = row->size; // validate the index want to insert the char into, at can go 1 char past the end of st
+        char ch = c;
+        rowInsert(row, at, &ch, 1); // there usually is room for it already, in the row's block or in its chunk
+        rowTabsInsert(row, at, c); // the tab index is updated instead of built again, typing on a long line with lots of tabs stays cheap
+        editorRowDropRender(row); // so that render & rsize fields get updated with new row content, what editorUpdateRow() does but keeping the tab index
+        editorUpdateSyntax(row);
+        E.dirty++; // incremnet bc make changes to text
+}
+
+// Simple backspacing: function which deletes a char in an erow
+void editorRowDelChar(erow *row, int at){
+        if(at < 0 || at >= row->size) return;
+        rowDelete(row, at, 1); // move the next char to the current cha
+        rowTabsDelete(row, at);
+        editorRowDropRender(row);
+        editorUpdateSyntax(row);
+        E.dirty++;
+}
+
+
+/* The 2 functions below is implementing backspacing at the start of a line. When the user backspace at the begining of a line, append the contents
+of that line to the previous line, and then delete the current line. This backspaces the implicit \n char in the between the 2 lines to join them into 1 */
+void editorFreeRow(erow * row){
+        editorRowDropRender(row);
+        rowFree(row->tabs, row->tabcap * sizeof(tabStop));
+        if(row->longrow) rowLongFree(row);
+        else rowFree(row->chars, row->charcap);
+}
+
+void editorDelRow(int at){
+        editorDelRows(at, 1);
+}
+
+// delete count rows starting at row at, with one cut out of the tree however many there are
+void editorDelRows(int at, int count){
+        if(at < 0 || at >= E.numrows || count < 1) return;
+        if(count > E.numrows - at) count = E.numrows - at;
+        rowNode *l, *mid, *r;
+        rowCut(at);
+        rowCut(at + count);
+        rowSplit(E.rows, at, &l, &r); // cut out the rows at position at, then glue the rest back together
+        rowSplit(r, count, &mid, &r);
+        rowSetRoot(rowMerge(l, r));
+        mid->parent = NULL;
+        rowFreeTree(mid); // free the memory owned by the rows
+        E.numrows -= count;
+        editorSyntaxShift(at, -count);
+        editorSyntaxMark(at); // the row that took their place starts after a different row now
+        E.dirty++;
+}
+
+// function which append a str to the end of a row
+void editorRowAppendString(erow *row, char *s, size_t len){
+        rowInsert(row, row->size, s, len); // copy the given str to the end of the contents of the row
+        editorUpdateRow(row); // udpate the row's copy version & its rsize
+        E.dirty++;
+}
+
+
+/* function converting render index into chars index before assigning it to E.cx: the char whose col(s) on screen include rx,
+the row's size if rx is past its end. Binary search for the tabs that end at or before rx, then rx is either after them or inside the next tab */
+int editorRowRxToCx(erow *row, int rx){
+        if(row->longrow) return rowLongRxToCx(rowLongOf(row), rx);
+        tabStop *tabs = rowTabs(row);
+        int lo = 0, hi = row->ntabs;
+        while(lo < hi){
+                int mid = (lo + hi) / 2;
+                if(tabs[mid].rxend <= rx) lo = mid + 1;
+                else hi = mid;
+        }
+        int cx = lo ? tabs[lo - 1].cx + 1 : 0, base = lo ? tabs[lo - 1].rxend : 0;
+        if(lo < row->ntabs && base + (tabs[lo].cx - cx) <= rx) cx = tabs[lo].cx; // rx is inside the next tab
+        else cx += rx - base;
+        return cx < row->size ? cx : row->size;
+}
+
+// the same by going through the row from the start. Kept for --bench-tabs
+int editorRowRxToCxLinear(erow *row, int rx){
+        int cur_rx = 0;
+        int cx;
+        for(cx = 0; cx < row->size; cx++){ // go through each char in a row
+                if(row->chars[cx] == '\t'){ // if it's tab
+                        cur_rx += (ONREE_TAB_STOP - 1) - (cur_rx % ONREE_TAB_STOP); // adjust cur_rx to account for the width of the tab. Calculate the spaces needed to reach the next tab
+                }
+                cur_rx++;
+
+                if(cur_rx > rx) return cx; // return the current position in the char array of the row when hit the tab 
+        }
+        return cx;
+}
+
+
+/***** Tab Index *****/
+/* Converting between chars & render indexes only depends on where the tabs are: between two tabs every char is one col.
+So each row keeps the chars index of its tabs & the render index each one ends at, a conversion is a binary search over them.
+It's built the first time it's needed, memchr() finds the tabs. Typing a char or deleting one moves the tabs after it by one,
+only their render indexes have to be worked out again, which happens at the next conversion */
+void rowTabsReset(erow *row){
+        row->ntabs = -1;
+        row->tabvalid = 0;
+}
+
+void rowTabsBuild(erow *row){
+        row->ntabs = 0;
+        row->tabvalid = 0;
+        char *p = row->chars, *end = row->chars + row->size;
+        while((p = memchr(p, '\t', end - p)) != NULL){
+                if(row->ntabs == row->tabcap) rowTabsGrow(row);
+                row->tabs[row->ntabs++].cx = p - row->chars;
+                p++;
+        }
+}
+
+// room for one more tab
+void rowTabsGrow(erow *row){
+        int cap = row->tabcap * sizeof(tabStop);
+        row->tabs = rowGrow(row->tabs, &cap, row->ntabs * sizeof(tabStop), (row->ntabs + 1) * sizeof(tabStop));
+        row->tabcap = cap / sizeof(tabStop); // every block size is a multiple of sizeof(tabStop)
+}
+
+// the tab index of row, built & brought up to date first if needed
+tabStop *rowTabs(erow *row){
+        if(row->ntabs == -1) rowTabsBuild(row);
+        for(int i = row->tabvalid; i < row->ntabs; i++){
+                int rx = i ? row->tabs[i - 1].rxend + (row->tabs[i].cx - row->tabs[i - 1].cx - 1) : row->tabs[i].cx; // where the tab starts
+                row->tabs[i].rxend = rx + ONREE_TAB_STOP - rx % ONREE_TAB_STOP; // to the next tab stop
+        }
+        row->tabvalid = row->ntabs;
+        return row->tabs;
+}
+
+// # tabs before chars index cx, a binary search
+int rowTabsBefore(erow *row, int cx){
+        int lo = 0, hi = row->ntabs;
+        while(lo < hi){
+                int mid = (lo + hi) / 2;
+                if(row->tabs[mid].cx < cx) lo = mid + 1;
+                else hi = mid;
+        }
+        return lo;
+}
+
+// char c was inserted at at
+void rowTabsInsert(erow *row, int at, int c){
+        if(row->ntabs == -1) return; // not built, nothing to update
+        int k = rowTabsBefore(row, at);
+        for(int i = k; i < row->ntabs; i++) row->tabs[i].cx++;
+        if(c == '\t'){
+                if(row->ntabs == row->tabcap) rowTabsGrow(row);
+                memmove(&row->tabs[k + 1], &row->tabs[k], (row->ntabs - k) * sizeof(tabStop));
+                row->tabs[k].cx = at;
+                row->ntabs++;
+        }
+        if(row->tabvalid > k) row->tabvalid = k;
+}
+
+// the char at at was deleted
+void rowTabsDelete(erow *row, int at){
+        if(row->ntabs == -1) return;
+        int k = rowTabsBefore(row, at);
+        if(k < row->ntabs && row->tabs[k].cx == at){ // it was a tab
+                memmove(&row->tabs[k], &row->tabs[k + 1], (row->ntabs - k - 1) * sizeof(tabStop));
+                row->ntabs--;
+        }
+        for(int i = k; i < row->ntabs; i++) row->tabs[i].cx--;
+        if(row->tabvalid > k) row->tabvalid = k;
+}
+
+/***** Long Rows *****/
+/* A row longer than ROW_LONG (minified code, a log without line breaks) is kept in chunks of at most ROW_CHUNK chars instead of one block,
+so typing into it moves the chars of one chunk, not the rest of the row. Each chunk knows where it starts in the row's chars & on screen,
+which is brought up to date lazily from the first chunk that moved, and the lexer state it ends in: after an edit the chunk is lexed again,
+then the ones after it until one ends in the same state as before. Nothing is kept rendered, drawing lexes & draws the chunks under the screen.
+Code that needs the text of a row in one piece copies it out with rowCopy() */
+rowLong *rowLongOf(erow *row){
+        return row->longrow ? E.longs[row->longrow - 1] : NULL;
+}
+
+// make row a row in chunks holding the len chars of s. The block chars was in, if any, is the caller's
+void rowLongBuild(erow *row, const char *s, int len){
+        rowLong *lng = calloc(1, sizeof(rowLong));
+        lng->row = row;
+        lng->lexfrom = lng->lexto = -1;
+        if(E.nlongs == E.longcap){
+                E.longcap = E.longcap ? E.longcap * 2 : 8;
+                E.longs = realloc(E.longs, E.longcap * sizeof(rowLong *));
+        }
+        E.longs[E.nlongs++] = lng;
+        row->longrow = E.nlongs;
+        row->chars = NULL;
+        row->charcap = 0;
+        row->size = len;
+        rowLongReplace(lng, 0, 0, s, len);
+}
+
+void rowLongFree(erow *row){
+        rowLong *lng = rowLongOf(row);
+        for(int k = 0; k < lng->n; k++) rowFree(lng->c[k].chars, ROW_CHUNK);
+        free(lng->c);
+        int i = row->longrow - 1;
+        E.longs[i] = E.longs[--E.nlongs]; // the last one takes its place
+        if(i < E.nlongs) E.longs[i]->row->longrow = i + 1;
+        free(lng);
+        row->longrow = 0;
+}
+
+// when the file is closed: the chunks' blocks go with every other row block, see rowAllocRelease()
+void rowLongReleaseAll(){
+        for(int i = 0; i < E.nlongs; i++){
+                free(E.longs[i]->c);
+                free(E.longs[i]);
+        }
+        E.nlongs = 0;
+}
+
+/* Put the len chars of s in place of chunks j to j + count - 1, cut in chunks ROW_CHUNK_FILL full (none if len is 0, unless the row
+would be left without a chunk). The chunks after them only move in the array */
+void rowLongReplace(rowLong *lng, int j, int count, const char *s, int len){
+        int m = (len + ROW_CHUNK_FILL - 1) / ROW_CHUNK_FILL;
+        if(m == 0 && lng->n == count) m = 1; // a row always has a chunk, even an empty one
+        int keep = j < lng->valid; // chunk j starts where it did, whatever goes there
+        int cx = keep ? lng->c[j].cx : 0, rx = keep ? lng->c[j].rx : 0;
+        for(int k = j; k < j + count; k++) rowFree(lng->c[k].chars, ROW_CHUNK);
+        if(lng->n - count + m > lng->cap){
+                lng->cap = (lng->n - count + m) * 2;
+                lng->c = realloc(lng->c, lng->cap * sizeof(rowChunk));
+        }
+        memmove(&lng->c[j + m], &lng->c[j + count], (lng->n - j - count) * sizeof(rowChunk));
+        lng->n += m - count;
+
+        for(int k = 0; k < m; k++){ // the chars are shared out evenly, so there's no small chunk at the end
+                rowChunk *c = &lng->c[j + k];
+                int from = (long)len * k / m, to = (long)len * (k + 1) / m, cap;
+                c->chars = rowAlloc(ROW_CHUNK, &cap);
+                c->size = to - from;
+                memcpy(c->chars, s + from, c->size);
+                memset(&c->end, 0, sizeof(hlState));
+                rowLongUpdate(c);
+        }
+        if(keep && j < lng->n){
+                lng->c[j].cx = cx;
+                lng->c[j].rx = rx;
+        }
+        if(lng->valid > j) lng->valid = j < lng->n ? j + 1 : j;
+
+        // the marked chunks move with the rest, marks on the replaced ones end up on the new ones
+        int *marks[2] = {&lng->lexfrom, &lng->lexto};
+        for(int i = 0; i < 2; i++){
+                if(*marks[i] >= j + count) *marks[i] += m - count;
+                else if(*marks[i] > j) *marks[i] = j;
+        }
+        // the chunk after them too: the new chunks have no end state yet to tell whether the next one starts the same as before
+        rowLongEdited(lng, j, m + 1, 0);
+}
+
+// where chunk c's first tab is & the cols after it, after its chars changed
+void rowLongUpdate(rowChunk *c){
+        char *t = memchr(c->chars, '\t', c->size), *end = c->chars + c->size;
+        c->firsttab = t ? t - c->chars : -1;
+        c->tailw = 0;
+        if(t == NULL) return;
+        int col = 0; // right after a tab is a tab stop
+        char *p = t + 1;
+        while((t = memchr(p, '\t', end - p)) != NULL){
+                col += t - p;
+                col += ONREE_TAB_STOP - col % ONREE_TAB_STOP;
+                p = t + 1;
+        }
+        c->tailw = col + (end - p);
+}
+
+// the render index right after chunk c, from the one it starts at
+int rowLongEndRx(rowChunk *c){
+        if(c->firsttab == -1) return c->rx + c->size;
+        int rx = c->rx + c->firsttab;
+        return rx + ONREE_TAB_STOP - rx % ONREE_TAB_STOP + c->tailw;
+}
+
+// bring the start of every chunk up to chunk upto up to date, each from the one before
+void rowLongValidate(rowLong *lng, int upto){
+        rowChunk *c = lng->c;
+        if(upto >= lng->n) upto = lng->n - 1;
+        for(int i = lng->valid; i <= upto; i++){
+                c[i].cx = i ? c[i - 1].cx + c[i - 1].size : 0;
+                c[i].rx = i ? rowLongEndRx(&c[i - 1]) : 0;
+        }
+        if(upto + 1 > lng->valid) lng->valid = upto + 1;
+}
+
+/* the chunk holding chars index cx, the last chunk for the end of the row. A binary search over the chunks whose start is known,
+past them the starts are worked out going forward */
+int rowLongFind(rowLong *lng, int cx){
+        rowChunk *c = lng->c;
+        if(lng->valid == 0) rowLongValidate(lng, 0);
+        int i = lng->valid - 1;
+        if(cx >= c[i].cx + c[i].size){
+                while(i + 1 < lng->n && cx >= c[i].cx + c[i].size) rowLongValidate(lng, ++i);
+                return i;
+        }
+        int lo = 0, hi = i;
+        while(lo < hi){
+                int mid = (lo + hi) / 2;
+                if(c[mid].cx + c[mid].size <= cx) lo = mid + 1;
+                else hi = mid;
+        }
+        return lo;
+}
+
+// the same for render index rx: the chunk drawn over col rx, the last chunk past the end of the row
+int rowLongFindRx(rowLong *lng, int rx){
+        rowChunk *c = lng->c;
+        if(lng->valid == 0) rowLongValidate(lng, 0);
+        int i = lng->valid - 1;
+        if(rx >= rowLongEndRx(&c[i])){
+                while(i + 1 < lng->n && rx >= rowLongEndRx(&c[i])) rowLongValidate(lng, ++i);
+                return i;
+        }
+        int lo = 0, hi = i;
+        while(lo < hi){
+                int mid = (lo + hi) / 2;
+                if(rowLongEndRx(&c[mid]) <= rx) lo = mid + 1;
+                else hi = mid;
+        }
+        return lo;
+}
+
+// chunks from to to may end in another state now
+void rowLongMark(rowLong *lng, int from, int to){
+        if(lng->lexfrom == -1 || from < lng->lexfrom) lng->lexfrom = from;
+        if(to > lng->lexto) lng->lexto = to;
+}
+
+// every chunk of every long row, when the filetype changes
+void rowLongMarkAll(){
+        for(int i = 0; i < E.nlongs; i++) rowLongMark(E.longs[i], 0, E.longs[i]->n - 1);
+}
+
+/* the chars of chunks j to j + m - 1 changed from off in chunk j on. Those chunks are marked,
+& the ones before whose lexing reads on into the change */
+void rowLongEdited(rowLong *lng, int j, int m, int off){
+        int from = j, gap = off; // chars between the end of chunk from - 1 & the change
+        while(from > 0 && gap < ROW_CHUNK_WINDOW) gap += lng->c[--from].size;
+        int to = j + m - 1;
+        if(to >= lng->n) to = lng->n - 1;
+        if(from > to) from = to;
+        if(to < from) to = from;
+        rowLongMark(lng, from, to);
+}
+
+// the state chunk j starts in
+hlState rowLongStart(rowLong *lng, int j){
+        if(j > 0) return lng->c[j - 1].end;
+        hlState st = {.in_comment = lng->start, .prev_sep = 1, .prev_hl = HL_NORMAL};
+        return st;
+}
+
+/* highlight chunk j starting in state st into hl, which needs room for ROW_CHUNK + ROW_CHUNK_WINDOW. The chunk is copied
+with what follows it in the row, so a token running past its end is seen whole */
+void rowLongLex(rowLong *lng, int j, hlState *st, unsigned char *hl){
+        static __thread char buf[ROW_CHUNK + ROW_CHUNK_WINDOW + 1]; // rows are relexed on the pool too, see editorSyntaxAll()
+        rowChunk *c = &lng->c[j];
+        memcpy(buf, c->chars, c->size);
+        int len = c->size;
+        for(int k = j + 1; k < lng->n && len < c->size + ROW_CHUNK_WINDOW; k++){
+                int take = c->size + ROW_CHUNK_WINDOW - len;
+                if(take > lng->c[k].size) take = lng->c[k].size;
+                memcpy(&buf[len], lng->c[k].chars, take);
+                len += take;
+        }
+        buf[len] = '\0';
+        editorHighlightRun(buf, len, c->size, hl, st);
+}
+
+/* bring the end state of the marked chunks up to date, with the row starting in state start. Returns whether the row ends inside a
+multi-line comment. Lexing stops at the first chunk past the marked ones that ends the same as before, the rest start the same */
+int rowLongRelex(rowLong *lng, int start){
+        static __thread unsigned char hl[ROW_CHUNK + ROW_CHUNK_WINDOW + 1];
+        if(start != lng->start){
+                lng->start = start;
+                rowLongMark(lng, 0, 0);
+        }
+        if(lng->lexfrom != -1){
+                hlState st = rowLongStart(lng, lng->lexfrom);
+                for(int j = lng->lexfrom; j < lng->n; j++){
+                        rowLongLex(lng, j, &st, hl);
+                        int changed = memcmp(&st, &lng->c[j].end, sizeof(hlState));
+                        lng->c[j].end = st;
+                        if(!changed && j >= lng->lexto) break;
+                }
+                lng->lexfrom = lng->lexto = -1;
+        }
+        return lng->c[lng->n - 1].end.in_comment;
+}
+
+// render index of chars index cx: where its chunk starts on screen, plus the chars & tabs before cx in the chunk
+int rowLongCxToRx(rowLong *lng, int cx){
+        if(cx > lng->row->size) cx = lng->row->size;
+        rowChunk *c = &lng->c[rowLongFind(lng, cx)];
+        int rx = c->rx;
+        char *p = c->chars, *end = c->chars + (cx - c->cx), *t;
+        while((t = memchr(p, '\t', end - p)) != NULL){
+                rx += t - p;
+                rx += ONREE_TAB_STOP - rx % ONREE_TAB_STOP;
+                p = t + 1;
+        }
+        return rx + (end - p);
+}
+
+// the char whose col(s) on screen include rx, the row's size if rx is past its end
+int rowLongRxToCx(rowLong *lng, int rx){
+        rowChunk *c = &lng->c[rowLongFindRx(lng, rx)];
+        int col = c->rx;
+        for(int i = 0; i < c->size; i++){
+                col += c->chars[i] == '\t' ? ONREE_TAB_STOP - col % ONREE_TAB_STOP : 1;
+                if(col > rx) return c->cx + i;
+        }
+        return lng->row->size;
+}
+
+/* draw the cols of a row in chunks that are on screen into cell, lexing the chunks they're in. Returns how many cols there are.
+The chunk states are brought up to date first if an edit was made with the highlighting off */
+int rowLongDraw(erow *row, screenCell *cell){
+        static unsigned char hl[ROW_CHUNK + ROW_CHUNK_WINDOW + 1];
+        rowLong *lng = rowLongOf(row);
+        if(E.syntax && lng->lexfrom != -1) editorUpdateSyntax(row);
+        int j = rowLongFindRx(lng, E.coloff);
+        rowChunk *c = lng->c;
+        if(E.coloff >= rowLongEndRx(&c[j])) return 0; // scrolled past the end of the row
+        hlState st = rowLongStart(lng, j);
+        int right = E.coloff + E.screencols, col = c[j].rx;
+        for(; j < lng->n && col < right; j++){
+                if(E.syntax) rowLongLex(lng, j, &st, hl);
+                else memset(hl, HL_NORMAL, c[j].size);
+                for(int i = 0; i < c[j].size && col < right; i++){
+                        unsigned char ch = c[j].chars[i];
+                        int color = hl[i] == HL_NORMAL ? 39 : editorSyntaxToColor(hl[i]);
+                        int w = 1;
+                        if(ch == '\t'){ // drawn as the spaces it renders to
+                                w = ONREE_TAB_STOP - col % ONREE_TAB_STOP;
+                                ch = ' ';
+                        }
+                        for(; w > 0; w--, col++){
+                                if(col < E.coloff || col >= right) continue;
+                                screenCell *cl = &cell[col - E.coloff];
+                                cl->ch = GLYPH[ch];
+                                cl->color = color;
+                                cl->flags = GLYPH_FLAGS[ch];
+                        }
+                }
+        }
+        int len = col - E.coloff;
+        return len < 0 ? 0 : len > E.screencols ? E.screencols : len;
+}
+
+/* Insert the len chars of s at at, in the row's block or in the chunk at. Only the chars, the caller brings the rest of the row up to date.
+A row that grows past ROW_LONG is cut in chunks here */
+void rowInsert(erow *row, int at, const char *s, int len){
+        rowLong *lng = rowLongOf(row);
+        if(lng == NULL){
+                rowSplice(row, at, 0, s, len);
+                return;
+        }
+
+        int j = rowLongFind(lng, at);
+        rowChunk *c = &lng->c[j];
+        int off = at - c->cx;
+        if(c->size + len <= ROW_CHUNK){ // room in the chunk
+                memmove(&c->chars[off + len], &c->chars[off], c->size - off);
+                memcpy(&c->chars[off], s, len);
+                c->size += len;
+                rowLongUpdate(c);
+                if(lng->valid > j + 1) lng->valid = j + 1;
+                rowLongEdited(lng, j, 1, off);
+        }
+        else{ // the chunk is cut in chunks again, with s in it
+                int size = c->size + len;
+                char *t = malloc(size);
+                memcpy(t, c->chars, off);
+                memcpy(&t[off], s, len);
+                memcpy(&t[off + len], &c->chars[off], c->size - off);
+                rowLongReplace(lng, j, 1, t, size);
+                free(t);
+        }
+        row->size += len;
+}
+
+/* Put the len chars of s in place of the dellen chars at at, with one move of the chars after them & at most one allocation however many
+chars change. In a row in chunks only the chunks from at on take part. Only the chars, like rowInsert() */
+void rowSplice(erow *row, int at, int dellen, const char *s, int len){
+        if(rowLongOf(row)){
+                rowDelete(row, at, dellen);
+                if(len) rowInsert(row, at, s, len);
+                return;
+        }
+        int size = row->size - dellen + len;
+        row->chars = rowGrow(row->chars, &row->charcap, row->size + 1, size + 1);
+        memmove(&row->chars[at + len], &row->chars[at + dellen], row->size - at - dellen + 1); // with the '\0'
+        memcpy(&row->chars[at], s, len);
+        row->size = size;
+        if(row->size > ROW_LONG){
+                char *chars = row->chars;
+                int cap = row->charcap;
+                editorRowDropRender(row); // render may be chars
+                rowFree(row->tabs, row->tabcap * sizeof(tabStop)); // conversions go through the chunks from now on
+                row->tabs = NULL;
+                row->tabcap = 0;
+                rowTabsReset(row);
+                rowLongBuild(row, chars, row->size);
+                rowFree(chars, cap);
+        }
+}
+
+// delete the len chars at at, from the row's block or its chunks
+void rowDelete(erow *row, int at, int len){
+        if(len <= 0) return;
+        rowLong *lng = rowLongOf(row);
+        if(lng == NULL){
+                memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+                row->size -= len;
+                return;
+        }
+
+        int j = rowLongFind(lng, at), k = rowLongFind(lng, at + len - 1);
+        rowChunk *c = lng->c;
+        int off = at - c[j].cx, endoff = at + len - c[k].cx; // the chars go up to endoff in chunk k
+        if(j == k && (c[j].size > len || lng->n == 1)){ // within a chunk, which isn't left empty
+                memmove(&c[j].chars[off], &c[j].chars[off + len], c[j].size - off - len);
+                c[j].size -= len;
+                rowLongUpdate(&c[j]);
+                if(lng->valid > j + 1) lng->valid = j + 1;
+                rowLongEdited(lng, j, 1, off);
+        }
+        else{ // what's left of chunks j to k goes in their place
+                int tail = c[k].size - endoff;
+                char *t = malloc(off + tail + 1);
+                memcpy(t, c[j].chars, off);
+                memcpy(&t[off], &c[k].chars[endoff], tail);
+                rowLongReplace(lng, j, k - j + 1, t, off + tail);
+                free(t);
+        }
+        row->size -= len;
+}
+
+// copy len chars of row starting at at into dst, out of the row's block or its chunks
+void rowCopy(erow *row, int at, int len, char *dst){
+        rowLong *lng = rowLongOf(row);
+        if(lng == NULL){
+                memcpy(dst, &row->chars[at], len);
+                return;
+        }
+        if(len <= 0) return;
+        int j = rowLongFind(lng, at), off = at - lng->c[j].cx;
+        while(len > 0){
+                rowChunk *c = &lng->c[j++];
+                int n = c->size - off < len ? c->size - off : len;
+                memcpy(dst, &c->chars[off], n);
+                dst += n;
+                len -= n;
+                off = 0;
+        }
+}
+
+
+/***** Editor Operations *****/
+/* This func take a char and use editorRowInsertChar() to insert that character into the position that the cursor is at
+ editorInsertChar() doesn’t have to worry about the details of modifying an erow, 
+ and editorRowInsertChar() doesn’t have to worry about where the cursor is.
+*/
+void editorInsertChar(int c){
+        if (E.cy == E.numrows) { // if the cursor is at the end of the current row, a new empty row will be appended
+                undoBegin(); // the row & the char are undone together
+                undoRecord(UNDO_ROW_INSERT, E.cy, 0, NULL, 0);
+                editorInsertRow(E.numrows, "", 0);
+                char ch = c;
+                undoRecord(UNDO_INSERT, E.cy, E.cx, &ch, 1);
+                undoEnd();
+        }
+        else{
+                char ch = c;
+                undoRecord(UNDO_INSERT, E.cy, E.cx, &ch, 1);
+        }
+        editorRowInsertChar(editorRowAt(E.cy), E.cx, c); // else insert a char at a specify location
+        E.cx++;
+}
+
+
+/* Insert text at the cursor, which ends up after it. Each \n starts a new row.
+Rather than going through editorInsertChar() for every char: the first line is added to the cursor's row with one copy, the rows after it are
+built on the side & put in the row tree with one split & merge, and their highlighting is marked as out of date to be redone by editorSyntaxCatchUp() */
+void editorInsertText(char *s, int len){
+        if(len == 0) return;
+        if(E.cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+        erow *row = editorRowAt(E.cy);
+
+        int i = 0;
+        while(i < len && s[i] != '\n') i++; // end of the first line
+        if(i == len){ // no line breaks, the text goes into the middle of the row
+                rowInsert(row, E.cx, s, len);
+                E.cx += len;
+                editorUpdateRow(row);
+                E.dirty++;
+                return;
+        }
+
+        // the chars after the cursor move to the end of the last line
+        int tlen = row->size - E.cx;
+        char *tail = malloc(tlen + 1);
+        rowCopy(row, E.cx, tlen, tail);
+        rowDelete(row, E.cx, tlen);
+        rowInsert(row, E.cx, s, i);
+
+        rowNode *lines = NULL; // tree of the new rows
+        int added = 0;
+        while(i < len){
+                int start = ++i; // past the line break
+                while(i < len && s[i] != '\n') i++;
+                rowNode *node = rowNewNode(-1, 1);
+                rowInit(&node->row, &s[start], i - start);
+                if(i == len){ // last line, the tail goes after it
+                        E.cx = i - start;
+                        rowInsert(&node->row, node->row.size, tail, tlen);
+                }
+                lines = rowMerge(lines, node);
+                added++;
+        }
+        free(tail);
+
+        int at = E.cy + 1;
+        rowNode *l, *r;
+        rowCut(at); // in case at is in the middle of a run of unloaded lines
+        rowSplit(E.rows, at, &l, &r);
+        rowSetRoot(rowMerge(rowMerge(l, lines), r));
+        E.numrows += added;
+        editorSyntaxShift(at, added);
+
+        editorUpdateRow(row);
+        editorSyntaxMark(at); // every new row, & the row after them, is highlighted again starting in the state of the row above
+        editorSyntaxMark(at + added - 1);
+        editorSyntaxMark(at + added);
+        E.cy += added;
+        E.dirty++;
+}
+
+/* Delete len chars starting at col of row at, a \n between two rows counts as a char: the rows it ends up in are joined.
+Undoing an edit of any size goes through here or editorInsertText(), so the time taken is the size of the edit */
+void editorDeleteText(int at, int col, int len){
+        erow *row = editorRowAt(at);
+        if(row == NULL || len <= 0) return;
+        if(col + len <= row->size){ // within the row
+                rowDelete(row, col, len);
+                editorUpdateRow(row);
+                E.dirty++;
+                return;
+        }
+
+        // find the row & col the deleted text ends at
+        int left = len - (row->size - col), rows = 0;
+        erow *last = row;
+        while(left > 0){
+                erow *next = editorRowNext(last);
+                if(next == NULL) break; // past the end of the file
+                left--; // the \n before next
+                rows++;
+                last = next;
+                if(left <= last->size) break;
+                left -= last->size;
+        }
+        if(left > last->size) left = last->size;
+
+        // row keeps what's before col, then what's after the deleted text in last
+        int tail = last->size - left;
+        char *t = malloc(tail + 1);
+        rowCopy(last, left, tail, t);
+        rowDelete(row, col, row->size - col);
+        rowInsert(row, col, t, tail);
+        free(t);
+        editorDelRows(at + 1, rows); // last is one of them
+        editorUpdateRow(row);
+}
+
+/* Put with in place of the n matches m on row at, in file order. Made as one edit of the row whatever n is: the text from the first match
+to the end of the last is put together on the side & spliced in with rowSplice(), the row is updated once, and the undo history gets that
+span deleted & the new one inserted. The cursor isn't moved, undoing puts it back where it is now */
+void editorReplaceRow(int at, searchMatch *m, int n, const char *with, int wlen){
+        erow *row = editorRowAt(at);
+        int first = m[0].cx, oldlen = m[n - 1].cx + m[n - 1].len - first;
+        int newlen = oldlen;
+        for(int i = 0; i < n; i++) newlen += wlen - m[i].len;
+
+        char *old = malloc(oldlen + newlen + 1);
+        char *span = old + oldlen, *p = span;
+        rowCopy(row, first, oldlen, old);
+        for(int i = 0, from = first; i < n; i++){ // the text between the matches, with with in place of each
+                memcpy(p, &old[from - first], m[i].cx - from);
+                p += m[i].cx - from;
+                memcpy(p, with, wlen);
+                p += wlen;
+                from = m[i].cx + m[i].len;
+        }
+
+        undoRecord(UNDO_DELETE, at, first, old, oldlen);
+        if(newlen) undoRecord(UNDO_INSERT, at, first, span, newlen);
+        rowSplice(row, first, oldlen, span, newlen);
+        editorUpdateRow(row);
+        E.dirty++;
+        free(old);
+}
+
+// also handle the case where the cursor is at the begining of a line
+void editorDelChar(){
+        if(E.cy == E.numrows) return; // if the cursor past the ned of the file, there's nothing to delelte. Return immediately
+        if(E.cx == 0 && E.cy == 0) return; // if the cursor is at the begining of the first line, there's nothing to do, return immediately
+
+        erow *row = editorRowAt(E.cy); // else get the row the cursor is currently on
+        if(E.cx > 0){ // if there's no char to the left, the cursor at begining of the
+                char ch;
+                rowCopy(row, E.cx - 1, 1, &ch);
+                undoRecord(UNDO_DELETE, E.cy, E.cx - 1, &ch, 1);
+                editorRowDelChar(row, E.cx - 1); // delete it and move cursor  1 to the left
+                E.cx--;
+        }
+        else{ // else E.cx == 0
+                erow *prev = editorRowAt(E.cy - 1);
+                undoRecord(UNDO_DELETE, E.cy - 1, prev->size, "\n", 1); // joining the rows deletes the \n between them
+                E.cx = prev->size; // set cursor hori. position to the end of the previous line
+                char *s = malloc(row->size + 1); // the row's text in one piece, it may be in chunks
+                rowCopy(row, 0, row->size, s);
+                editorRowAppendString(prev, s, row->size);
+                free(s);
+                editorDelRow(E.cy);
+                E.cy--;
+        }
+}
+
+
+void editorInsertNewLine(){
+        if(E.cy == E.numrows) undoRecord(UNDO_ROW_INSERT, E.cy, 0, NULL, 0); // past the last row, a row is added
+        else undoRecord(UNDO_INSERT, E.cy, E.cx, "\n", 1); // splitting the row inserts a \n
+        if(E.cx == 0){ // if at begining of the line, insert a new blank row before the line currently on
+                editorInsertRow(E.cy, "", 0); 
+        }
+        else{ // else split the lien currenlty on into rows
+                erow *row = editorRowAt(E.cy);
+                // pass the chars on the current row that are to the right of the cursor. It will create a new row after the current one containing the chars to the right of the curso
+                int tlen = row->size - E.cx;
+                char *tail = malloc(tlen + 1); // copied out in one piece, the row may be in chunks
+                rowCopy(row, E.cx, tlen, tail);
+                editorInsertRow(E.cy + 1, tail, tlen); // row stays valid, rows are never moved in memory
+                free(tail);
+                // update the current row to contain only the chars to the left of the curso
+                rowDelete(row, E.cx, tlen);
+                editorUpdateRow(row); // update the copy of the current row
+        }
+        E.cy++; // move to the next row
+        E.cx = 0;
+}
+
+/***** Undo *****/
+/* Every edit is recorded as an entry saying what text went in or came out where, never a copy of the rows, so a big file costs nothing extra.
+Entries go one after another into chunks, undo takes the newest off & does the opposite, which takes as long as the edit did.
+Chars typed one after another are added to the same entry, so they're undone together. When the history gets bigger than E.undo.cap
+its oldest chunks are dropped */
+void undoInit(){
+        undoClear(&E.undo.done);
+        undoClear(&E.undo.undone);
+        E.undo.group = E.undo.grouping = E.undo.floor = 0;
+        char *mb = getenv("ONREE_UNDO_MB");
+        long cap = mb ? atol(mb) : UNDO_CAP_MB;
+        if(cap < 1) cap = UNDO_CAP_MB;
+        E.undo.cap = (size_t)cap << 20;
+}
+
+undoEntry *undoTop(undoLog *log){
+        if(log->newest == NULL || log->newest->last == -1) return NULL;
+        return (undoEntry *)&log->newest->data[log->newest->last];
+}
+
+// add an entry on top of log, with a copy of len bytes at s. Returns it
+undoEntry *undoPush(undoLog *log, int type, int group, int row, int col, int cy, int cx, const char *s, int len){
+        size_t need = (sizeof(undoEntry) + len + 7) & ~(size_t)7;
+        undoChunk *c = log->newest;
+        if(c == NULL || c->used + need > c->size){ // a new chunk, bigger than UNDO_CHUNK if the entry doesn't fit in one
+                size_t size = need > UNDO_CHUNK ? need : UNDO_CHUNK;
+                c = malloc(sizeof(undoChunk) + size);
+                c->size = size;
+                c->used = 0;
+                c->last = -1;
+                c->newer = NULL;
+                c->older = log->newest;
+                if(log->newest) log->newest->newer = c;
+                else log->oldest = c;
+                log->newest = c;
+                log->bytes += sizeof(undoChunk) + size;
+        }
+        undoEntry *e = (undoEntry *)&c->data[c->used];
+        e->prev = c->last;
+        e->type = type;
+        e->group = group;
+        e->row = row;
+        e->col = col;
+        e->cy = cy;
+        e->cx = cx;
+        e->len = len;
+        if(len) memcpy(e + 1, s, len);
+        c->last = c->used;
+        c->used += need;
+        return e;
+}
+
+// take the top entry off log
+void undoPop(undoLog *log){
+        undoChunk *c = log->newest;
+        if(c == NULL || c->last == -1) return;
+        undoEntry *e = (undoEntry *)&c->data[c->last];
+        c->used = c->last;
+        c->last = e->prev;
+        if(c->last == -1){ // empty, free it
+                log->newest = c->older;
+                if(log->newest) log->newest->newer = NULL;
+                else log->oldest = NULL;
+                log->bytes -= sizeof(undoChunk) + c->size;
+                free(c);
+        }
+}
+
+// drop the oldest chunk of log. The newest group in it might go on in the next chunk, it can't be undone any more
+void undoDropOldest(undoLog *log){
+        undoChunk *c = log->oldest;
+        if(c == NULL) return;
+        if(c->last != -1){
+                undoEntry *e = (undoEntry *)&c->data[c->last];
+                if(e->group > E.undo.floor) E.undo.floor = e->group;
+        }
+        log->oldest = c->newer;
+        if(log->oldest) log->oldest->older = NULL;
+        else log->newest = NULL;
+        log->bytes -= sizeof(undoChunk) + c->size;
+        free(c);
+}
+
+void undoClear(undoLog *log){
+        while(log->oldest){
+                undoChunk *c = log->oldest;
+                log->oldest = c->newer;
+                free(c);
+        }
+        log->newest = NULL;
+        log->bytes = 0;
+}
+
+/* record an edit about to be made, the cursor is still where it was before it. Called by the editor operations only,
+undoing & redoing go through editorInsertText() & editorDeleteText() which record nothing */
+void undoRecord(int type, int row, int col, const char *s, int len){
+        undoClear(&E.undo.undone); // a new edit, what was undone can't be redone any more
+
+        undoEntry *top = undoTop(&E.undo.done);
+        undoChunk *c = E.undo.done.newest;
+        if(top && type == top->type && len == 1 && s[0] != '\n' && top->len < UNDO_COALESCE_MAX && top->row == row &&
+                        (top->len == 0 || ((char *)(top + 1))[0] != '\n') && top->group > E.undo.floor && !E.undo.grouping){
+                size_t need = (sizeof(undoEntry) + top->len + 1 + 7) & ~(size_t)7;
+                char *text = (char *)(top + 1);
+                if(c->last + need <= c->size){ // room to grow the entry where it is
+                        if(type == UNDO_INSERT && top->col + top->len == col){ // typed right after the chars before it
+                                text[top->len++] = s[0];
+                                c->used = c->last + need;
+                                return;
+                        }
+                        if(type == UNDO_DELETE && col + 1 == top->col){ // backspace, the char goes in front
+                                memmove(text + 1, text, top->len++);
+                                text[0] = s[0];
+                                top->col = col;
+                                c->used = c->last + need;
+                                return;
+                        }
+                        if(type == UNDO_DELETE && col == top->col){ // delete key, the char goes after
+                                text[top->len++] = s[0];
+                                c->used = c->last + need;
+                                return;
+                        }
+                }
+        }
+
+        int group = E.undo.grouping ? E.undo.group : ++E.undo.group;
+        undoPush(&E.undo.done, type, group, row, col, E.cy, E.cx, s, len);
+        while(E.undo.done.bytes > E.undo.cap && E.undo.done.oldest) undoDropOldest(&E.undo.done);
+}
+
+// everything recorded until undoEnd() is undone as one edit
+void undoBegin(){
+        if(E.undo.grouping++ == 0) E.undo.group++;
+}
+
+void undoEnd(){
+        E.undo.grouping--;
+}
+
+// make the edit e again, or undo it (reverse)
+void undoApply(undoEntry *e, int reverse){
+        char *text = (char *)(e + 1);
+        int insert = (e->type == UNDO_INSERT) != reverse; // undoing a delete is inserting & the other way round
+        if(e->type == UNDO_ROW_INSERT){
+                if(reverse) editorDelRow(e->row);
+                else editorInsertRow(e->row, "", 0);
+                E.cy = e->row;
+                E.cx = 0;
+        }
+        else if(insert){
+                E.cy = e->row;
+                E.cx = e->col;
+                editorInsertText(text, e->len); // leaves the cursor after the text
+        }
+        else{
+                editorDeleteText(e->row, e->col, e->len);
+                E.cy = e->row;
+                E.cx = e->col;
+        }
+        if(reverse){ // back where the cursor was before the edit
+                E.cy = e->cy;
+                E.cx = e->cx;
+        }
+        if(E.cy > E.numrows) E.cy = E.numrows;
+        erow *row = editorRowAt(E.cy);
+        if(E.cx > (row ? row->size : 0)) E.cx = row ? row->size : 0;
+}
+
+// undo the newest group of edits, newest edit first
+void editorUndo(){
+        undoEntry *e = undoTop(&E.undo.done);
+        if(e == NULL || e->group <= E.undo.floor){
+                editorSetStatusMessage("Nothing to undo");
+                return;
+        }
+        int group = e->group;
+        while((e = undoTop(&E.undo.done)) && e->group == group){
+                undoApply(e, 1);
+                undoPush(&E.undo.undone, e->type, e->group, e->row, e->col, e->cy, e->cx, (char *)(e + 1), e->len);
+                undoPop(&E.undo.done);
+        }
+}
+
+// redo the group undone last, oldest edit first
+void editorRedo(){
+        undoEntry *e = undoTop(&E.undo.undone);
+        if(e == NULL){
+                editorSetStatusMessage("Nothing to redo");
+                return;
+        }
+        int group = e->group;
+        while((e = undoTop(&E.undo.undone)) && e->group == group){
+                undoApply(e, 0);
+                undoPush(&E.undo.done, e->type, e->group, e->row, e->col, e->cy, e->cx, (char *)(e + 1), e->len);
+                undoPop(&E.undo.undone);
+        }
+        while(E.undo.done.bytes > E.undo.cap && E.undo.done.oldest) undoDropOldest(&E.undo.done);
+}
+
+/*** syntax highlighting ***/
+/* Highlight one line of text. s is the text, len chars long and followed by a '\0', hl gets one highlight for each char of s.
+in_comment is whether the line starts inside a multi-line comment (the state the row above ended in). Returns whether the line ends inside one */
+int editorHighlightLine(char *s, int len, unsigned char *hl, int in_comment){
+        hlState st = {.in_comment = in_comment, .prev_sep = 1, .prev_hl = HL_NORMAL};
+        editorHighlightRun(s, len, len, hl, &st);
+        return st.in_comment;
+}
+
+/* Highlight the chars of s before stop, starting in state st which is left in the state after them. The chars from stop to len
+are what follows in the line, a token that starts before stop is finished in them. A line in one piece has stop == len */
+void editorHighlightRun(char *s, int len, int stop, unsigned char *hl, hlState *st){
+        memset(hl, HL_NORMAL, len);
+        if(E.syntax == NULL) return; // rturn immediately after memset()ting the entire line to HL_NORMAL.
+        if(st->line_comment){ // the rest of the line is a comment
+                memset(hl, HL_COMMENT, len);
+                return;
+        }
+
+        struct editorSyntax *syn = E.syntax;
+        const unsigned char *lex = syn->lex; // what each byte may start, see syntaxCompile()
+        keywordTable *kwtable = syn->kwtable;
+
+        char *scs = syn->singleline_comment_start;
+        char *mcs = syn->multiline_comment_start;
+        char *mce = syn->multiline_comment_end;
+
+        int scs_len = scs ? strlen(scs) : 0;
+        int mcs_len = mcs ? strlen(mcs) : 0;
+        int mce_len = mce ? strlen(mce) : 0;
+        int multiline = mcs_len && mce_len;
+
+
+        int prev_sep = st->prev_sep; // keep track of whether the previous char was a separator, 1 is true consider the begining of the line to be a separtor
+        int in_string = st->in_string; // keep track of whether currently inside a string. If inside, keep highlighting the current character as a string until hit the closing quote
+        int in_comment = multiline && st->in_comment;
+
+        int i = st->skip < len ? st->skip : len; // chars the last token of the piece before took
+        memset(hl, st->skip_hl, i);
+        while(i < stop){ // go through each char in a line
+                if(in_comment){ // everything up to the end of the comment is comment, only the bytes that can start its end are looked at
+                        char *p = &s[i], *end = &s[stop];
+                        while((p = memchr(p, mce[0], end - p)) != NULL && strncmp(p, mce, mce_len)) p++;
+                        if(p == NULL){ // doesn't end before stop
+                                memset(&hl[i], HL_MLCOMMENT, stop - i);
+                                i = stop;
+                                break;
                         }
-                        else if(!strncmp(&row->render[i], mcs, mcs_len)){ // if not in a multi-line comment, check to see if at the begining of the comment
-                                memset(&row->hl[i], HL_MLCOMMENT, mcs_len); // highlight the whole mcs string
-                                i += mcs_len;
-                                in_comment = 1; // set to true
+                        memset(&hl[i], HL_MLCOMMENT, p - &s[i] + mce_len); // with the whole mce string
+                        i = p - s + mce_len;
+                        in_comment = 0;
+                        prev_sep = 1;
+                        continue;
+                }
+
+                if(in_string){
+                        hl[i] = HL_STRING;
+                        if(s[i] == '\\' && i + 1 < len){ // if current char is backflash and there's 1 more char after it, then highlight the char after the backflash and consume it
+                                hl[i+1] = HL_STRING;
+                                i += 2; // consume both char at once
                                 continue;
                         }
+                        if((unsigned char)s[i] == in_string) in_string = 0; // if match the opening quote(the end of string)
+                        i++;
+                        prev_sep = 1;
+                        continue;
                 }
 
+                unsigned char c = s[i]; // get the current char from a row
+                int k = lex[c];
+                if(k == 0 && !prev_sep){ // inside a word, nothing to do until the next byte that's something else
+                        while(++i < stop && lex[(unsigned char)s[i]] == 0);
+                        continue;
+                }
 
-                if(E.syntax->flags & HL_HIGHLIGHT_STRINGS){
-                        if(in_string){
-                                row->hl[i] = HL_STRING;
-                                if(c == '\\' && i + 1 < row->rsize){ // if current char is backflash and there's 1 more char after it, then highlight the char after the backflash and consume it
-                                        row->hl[i+1] = HL_STRING;
-                                        i += 2; // consume both char at once
-                                        continue;
-                                }
-                                if(c == in_string) in_string = 0; // if match the opening quote(the end of string)
-                                i++;
-                                prev_sep = 1;
+                if(k & LEX_COMMENT){ // the multi-line start first, it can begin with the single-line one (--[[ & -- in Lua)
+                        if(multiline && !strncmp(&s[i], mcs, mcs_len)){ // at the begining of a multi-line comment
+                                memset(&hl[i], HL_MLCOMMENT, mcs_len); // highlight the whole mcs string
+                                i += mcs_len;
+                                in_comment = 1; // set to true
                                 continue;
                         }
-                        else{
-                                if(c == '"' || c == '\''){ // if not in a string, check if at the beginning of one by checking for a double- or single-quote
-                                        in_string = c; // store quote in string
-                                        row->hl[i] = HL_STRING; // highligh it
-                                        i++; // consume it
-                                        continue;
-                                }
+                        // single-line comments should not be recognized inside multi-line comments, in_comment is 0 here
+                        if(scs_len && !strncmp(&s[i], scs, scs_len)){
+                                memset(&hl[i], HL_COMMENT, len - i);
+                                st->line_comment = 1;
+                                st->skip = 0;
+                                st->in_comment = in_comment;
+                                return;
                         }
                 }
 
-
-                if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS){ // check if numbers should be highlighted for the current filetype
-                        if((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)){ // A . character that comes after a character that just highlighted as a number will now be considered part of the number
-                                row->hl[i] = HL_NUMBER;
-                                i++; // consume the char currently highlighted
-                                prev_sep = 0; // indicate in the middle of highlighting something
-                                continue;
-                        }
+                if(k & LEX_QUOTE){ // the beginning of a string, remember its quote to find its end
+                        in_string = c;
+                        hl[i] = HL_STRING;
+                        i++;
+                        continue;
                 }
 
-                if(prev_sep){
-                        int j;
-                        for(j = 0; keywords[j]; j++){
-                                int klen = strlen(keywords[j]); // store the len of keyword
-                                int kw2 = keywords[j][klen - 1] == '|'; // check to see if the last char of keyword is |, then decrement
-                                if(kw2) klen--;
+                unsigned char prev_hl = (i > 0)? hl[i-1] : st->prev_hl;
+                if(((k & LEX_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) || ((k & LEX_DOT) && prev_hl == HL_NUMBER)){ // A . character that comes after a character that just highlighted as a number will now be considered part of the number
+                        hl[i] = HL_NUMBER;
+                        i++; // consume the char currently highlighted
+                        prev_sep = 0; // indicate in the middle of highlighting something
+                        continue;
+                }
 
-                                // check if keyword exist at the current position in the text & check if a separator char comes after the keyword
-                                if(!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])){
-                                        memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen); // highlight the whole keyworde depends on the value of kw2
-                                        i += klen; // consume the entire word, then move on to the next index
-                                        break; // break bc still inside the inner loop. Everytime break out of this, the if statement below will runs to continue the iteration
-                                }
-                        }
-                        if(keywords[j] != NULL){
+                if(prev_sep && !(k & LEX_SEP)){
+                        // a keyword has to be a whole word: find where the word starting here ends, then look it up
+                        int wlen = 1;
+                        while(i + wlen < len && !(lex[(unsigned char)s[i + wlen]] & LEX_SEP)) wlen++;
+                        int type = keywordLookup(kwtable, &s[i], wlen);
+                        if(type){
+                                memset(&hl[i], type, wlen); // highlight the whole keyworde depends on its type
+                                i += wlen; // consume the entire word, then move on to the next index
                                 prev_sep = 0; // 0 means current char is part of the keyword(not a separator)
                                 continue;
                         }
                 }
 
-                prev_sep = is_separator(c);
+                prev_sep = k & LEX_SEP;
                 i++;
         }
 
-        int changed = (row->hl_open_comment != in_comment);
-        row->hl_open_comment = in_comment; // set the value of the current row’s hl_open_comment to whatever state in_comment got left in after processing the entire row. This tells whether the row ended as an unclosed multi-line comment or not
-        if(changed && row->idx + 1 < E.numrows){
-                editorUpdateSyntax(&E.row[row->idx + 1]); // editorUpdateSyntax() keeps calling itself with the next line, the change will continue to propagate to more and more lines until one of them is unchanged
+        st->in_comment = in_comment;
+        st->in_string = in_string;
+        st->prev_sep = prev_sep;
+        if(i > stop){ // the last token goes on past stop, the next piece starts after it
+                st->skip = i - stop;
+                st->skip_hl = hl[stop];
+        }
+        else{
+                st->skip = 0;
+        }
+        if(stop > 0) st->prev_hl = hl[stop - 1];
+}
+
+/* Work out the row's hl_open_comment again, from the state the row above ended in. Returns whether it changed.
+Only the state is needed here so the row is highlighted into a scratch buffer, hl itself is rebuilt when the row is drawn */
+int editorSyntaxRelex(erow *row){
+        if(E.syntax == NULL){ // no filetype, no state to keep
+                editorRowDropHighlight(row);
+                row->hl_open_comment = 0;
+                return 0;
+        }
+
+        rowPos p = {rowNodeOf(row), 0};
+        return rowPosRelex(&p, editorSyntaxStart(row)); // initialize in_comment to true if the row above has an unclosed multi-line comment. If that’s the case, then the current row will start out being highlighted as a multi-line comment.
+}
+
+/* Whether row ends inside a multi-line comment when it starts in state in_comment. Only reads the row (& the chunk states of a long row),
+so the pool can do this for many rows at once */
+int editorRowEndState(erow *row, int in_comment){
+        if(row->longrow) return rowLongRelex(rowLongOf(row), in_comment); // only the chunks that changed, see Long Rows
+
+        static __thread unsigned char *scratch = NULL; // one per thread, kept for the next row
+        static __thread int scratch_size = 0;
+        if(row->size + 1 > scratch_size){
+                scratch_size = row->size * 2 + 64;
+                scratch = realloc(scratch, scratch_size);
+        }
+        return editorHighlightLine(row->chars, row->size, scratch, in_comment); // tabs only turn into spaces in render, the state comes out the same from chars
+}
+
+/* Same as editorRowEndState() for a row position: a line still in the mapped file is lexed where it is, without loading it.
+It isn't followed by a '\0' there, so it's copied out first as the lexer needs. Thread-safe too */
+int rowPosEndState(rowPos *p, int in_comment){
+        if(p->node->fileline == -1) return editorRowEndState(&p->node->row, in_comment);
+
+        static __thread char *line = NULL;
+        static __thread unsigned char *scratch = NULL;
+        static __thread int scratch_size = 0;
+        int len;
+        char *s = rowFileLine(p->node->fileline + p->line, &len);
+        if(len + 1 > scratch_size){
+                scratch_size = len * 2 + 64;
+                line = realloc(line, scratch_size);
+                scratch = realloc(scratch, scratch_size);
+        }
+        memcpy(line, s, len);
+        line[len] = '\0';
+        return editorHighlightLine(line, len, scratch, in_comment);
+}
+
+// the state a row position ends in: a loaded row keeps it in hl_open_comment, a line still in the mapped file in E.hlstate
+int rowPosState(rowPos *p){
+        if(p->node->fileline == -1) return p->node->row.hl_open_comment;
+        return E.hlstate[p->node->fileline + p->line];
+}
+
+void rowPosSetState(rowPos *p, int in_comment){
+        if(p->node->fileline == -1) p->node->row.hl_open_comment = in_comment;
+        else E.hlstate[p->node->fileline + p->line] = in_comment;
+}
+
+// work out the state of the row at p again when it starts in in_comment, loaded or not. Returns whether it changed
+int rowPosRelex(rowPos *p, int in_comment){
+        if(p->node->fileline == -1) editorRowDropHighlight(&p->node->row); // highlighting changes with the state the row starts in, so the cached hl is out of date
+        in_comment = rowPosEndState(p, in_comment);
+        int changed = (rowPosState(p) != in_comment);
+        rowPosSetState(p, in_comment); // whether the row ended as an unclosed multi-line comment or not
+        return changed;
+}
+
+// the state row starts in: the one the row above ended in, loaded or still in the mapped file
+int editorSyntaxStart(erow *row){
+        rowPos p = {rowNodeOf(row), 0};
+        return rowPosPrev(&p) ? rowPosState(&p) : 0;
+}
+
+/* Rows from E.hl_known on have a state nobody worked out yet: they weren't needed so far, a row is loaded & highlighted
+without loading the rows above it. Called before the state above row at is used, works out the rows in between top to bottom.
+The ones still in the mapped file are lexed where they are & stay unloaded, their state is kept in E.hlstate */
+void editorSyntaxKnow(int at){
+        if(E.syntax == NULL || at <= E.hl_known) return;
+        if(at > E.numrows) at = E.numrows;
+        if(at - E.hl_known > HL_BLOCK_ROWS){ // a jump far down the file, done on every core
+                editorSyntaxAll(E.hl_known, at - 1);
+                return;
+        }
+
+        rowPos p;
+        rowPosAt(&p, E.hl_known);
+        rowPos above = p;
+        int in_comment = rowPosPrev(&above) ? rowPosState(&above) : 0;
+        for(int i = E.hl_known; i < at; i++){
+                rowPosRelex(&p, in_comment);
+                in_comment = rowPosState(&p);
+                rowPosNext(&p);
+        }
+        E.hl_known = at;
+}
+
+/* Called right after a row's chars change. Only this row is done now, if its state changed the rows below
+are only marked and redone by editorSyntaxCatchUp(): the visible ones before the next frame, the rest when the editor is idle.
+So opening a comment at the top of a big file costs the same as anywhere else */
+void editorUpdateSyntax(erow *row){
+        long start = statNow();
+        if(E.syntax){
+                int at = editorRowIndex(row);
+                editorSyntaxKnow(at); // so the row above has its state to start in
+                if(editorSyntaxRelex(row)) editorSyntaxMark(at + 1);
+                if(E.hl_known == at) E.hl_known = at + 1;
+        }
+        else{
+                editorSyntaxRelex(row);
+        }
+        statAdd(STAT_SYNTAX, start);
+}
+
+/* Every row's hl_open_comment is a checkpoint: the state the next row starts in. Rows from E.hl_from on may have a
+checkpoint that's out of date, down to at least E.hl_to. Both are -1 when every checkpoint is up to date */
+void editorSyntaxMark(int at){
+        if(at >= E.numrows) return;
+        if(E.hl_from > E.hl_to) E.hl_to = E.hl_from; // a change still going down past hl_to, keep redoing down to where it got
+        if(E.hl_from == -1 || at < E.hl_from) E.hl_from = at;
+        if(at > E.hl_to) E.hl_to = at;
+}
+
+// keep the marked rows pointing at the same rows when delta rows are inserted (delta > 0) or -delta are deleted (delta < 0) at row at
+void editorSyntaxShift(int at, int delta){
+        if(E.hl_known > at) E.hl_known = (E.hl_known + delta > at) ? E.hl_known + delta : at; // the rows worked out stay worked out
+        if(E.hl_from == -1) return;
+        int *marks[2] = {&E.hl_from, &E.hl_to};
+        for(int i = 0; i < 2; i++){
+                int *m = marks[i];
+                if(delta > 0 && *m >= at) *m += delta;
+                else if(delta < 0 && *m > at) *m = (*m + delta > at) ? *m + delta : at; // a deleted row becomes the row that took its place
+        }
+        if(E.hl_to >= E.numrows) E.hl_to = E.numrows - 1;
+        if(E.hl_from >= E.numrows) E.hl_from = E.hl_to = -1; // hl_from may be past hl_to, while a change is still going down the rows
+}
+
+/* Redo marked rows top to bottom, iteratively. Stops once a row's state didn't change and no marked rows are left below,
+after redoing budget rows, or after row until. Rows still in the mapped file are redone where they are, without loading them.
+Returns whether a row that's on the screen was redone */
+int editorSyntaxCatchUp(int until, int budget){
+        int visible = 0;
+        if(E.syntax == NULL){ // no filetype, no state to keep
+                E.hl_from = E.hl_to = -1;
+                return 0;
+        }
+
+        rowPos p = {NULL, 0};
+        int in_comment = 0;
+        while(E.hl_from != -1 && E.hl_from <= until && budget-- > 0){
+                int at = E.hl_from;
+                if(at >= E.hl_known && at > E.hl_to){ // the rows below were never worked out, they get the right state when needed
+                        E.hl_from = E.hl_to = -1;
+                        break;
+                }
+                if(p.node == NULL){
+                        editorSyntaxKnow(at);
+                        rowPosAt(&p, at);
+                        rowPos above = p;
+                        in_comment = rowPosPrev(&above) ? rowPosState(&above) : 0;
+                }
+
+                int changed = rowPosRelex(&p, in_comment);
+                in_comment = rowPosState(&p);
+                if(at >= E.hl_known) E.hl_known = at + 1;
+                if(at >= E.rowoff && at < E.rowoff + E.screenrows) visible = 1;
+
+                if((changed || at < E.hl_to) && at + 1 < E.numrows){
+                        E.hl_from = at + 1;
+                        rowPosNext(&p);
+                }
+                else{
+                        E.hl_from = E.hl_to = -1;
+                }
+        }
+        return visible;
+}
+
+// task run on the pool: the state every row of one block ends in, as if the block started outside a multi-line comment
+void syntaxBlockTask(void *arg){
+        hlBlock *b = arg;
+        rowPos p = b->start;
+        int in_comment = 0;
+        for(int i = 0; i < b->n; i++){
+                in_comment = rowPosEndState(&p, in_comment);
+                rowPosSetState(&p, in_comment);
+                if(i + 1 < b->n) rowPosNext(&p);
+        }
+        b->end = in_comment;
+}
+
+/* Work out the state of every row from first to last at once, when the filetype changed or a row far below E.hl_known is needed.
+The rows are cut in blocks highlighted on every core, each as if it started outside a multi-line comment, which is what most blocks
+of a file do. Then the blocks are gone through in order: one that really starts inside a comment is redone from its first row until
+a row ends in the state it got the first time, from there on the block is right as it was. So only the rows right after an unclosed
+comment are done twice. Rows still in the mapped file are read with row positions & stay unloaded */
+void editorSyntaxAll(int first, int last){
+        long start = statNow();
+        int n = last - first + 1;
+
+        // a few blocks per thread so a thread that finishes early can pick up more work
+        int nblocks = n / HL_BLOCK_ROWS + 1;
+        int most = poolThreads() * 4;
+        if(nblocks > most) nblocks = most;
+        hlBlock *blocks = calloc(nblocks, sizeof(hlBlock));
+        taskGroup group = TASKGROUP_INIT;
+        for(int b = 0; b < nblocks; b++){
+                int from = (long)n * b / nblocks, to = (long)n * (b + 1) / nblocks;
+                blocks[b].n = to - from;
+                rowPosAt(&blocks[b].start, first + from);
+                if(nblocks == 1) syntaxBlockTask(&blocks[b]); // a small file is just done here
+                else poolSubmit(&group, syntaxBlockTask, &blocks[b]);
+        }
+        poolWait(&group);
+
+        // the blocks in order, with the state each really starts in
+        rowPos above = blocks[0].start;
+        int in_comment = rowPosPrev(&above) ? rowPosState(&above) : 0;
+        for(int b = 0; b < nblocks; b++){
+                hlBlock *blk = &blocks[b];
+                if(!in_comment){ // started the way it was done
+                        in_comment = blk->end;
+                        continue;
+                }
+                rowPos p = blk->start;
+                int i;
+                for(i = 0; i < blk->n; i++){
+                        int was = rowPosState(&p);
+                        in_comment = rowPosEndState(&p, in_comment);
+                        rowPosSetState(&p, in_comment);
+                        if(in_comment == was) break; // the rows after it start the same as the first time
+                        rowPosNext(&p);
+                }
+                if(i < blk->n) in_comment = blk->end;
+        }
+        free(blocks);
+        E.hl_known = last + 1;
+        statAdd(STAT_SYNTAX, start);
+}
+
+// called while waiting for a key: finish redoing rows in batches, until a key arrives. Returns whether the screen needs redrawing
+int editorSyntaxIdle(){
+        int visible = 0;
+        struct pollfd pfd = {IN.fd, POLLIN, 0};
+        while(E.hl_from != -1){
+                visible |= editorSyntaxCatchUp(E.numrows, ONREE_HL_BUDGET);
+                if(inputPending() || poll(&pfd, 1, 0) > 0) break; // a key is waiting, deal with it first
         }
+        return visible;
 }
 
 
@@ -1276,14 +5497,771 @@ int is_separator(int c){
         return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
+// read the syntax files & build the lookup tables used by editorHighlightLine(), once at startup
+void editorSyntaxInit(){
+        for(int c = 0; c < 256; c++) SEPARATORS[c] = c < 128 && is_separator(c); // bytes above 127 are never separators
+        syntaxLoadFiles();
+        for(unsigned int j = 0; j < HLDB_ENTRIES; j++){
+                if(HLDB[j].kwtable == NULL) syntaxCompile(&HLDB[j]);
+        }
+}
+
+/* turn a filetype into the tables the lexer runs on: its keywords into a keywordTable, its delimiters & the separators into the LEX_ bits
+of every byte. A byte with no bits is part of a word, the lexer goes over a run of those without looking at them one by one */
+void syntaxCompile(struct editorSyntax *syn){
+        syn->kwtable = keywordTableBuild(syn->keywords);
+        if(syn->kwtable == NULL){ // its keywords aren't highlighted, the rest is
+                if(!E.statusmsg[0]) editorSetStatusMessage("%s: no hash table fits its keywords", syn->filetype);
+                char *none[] = {NULL};
+                syn->kwtable = keywordTableBuild(none);
+        }
+        for(int c = 0; c < 256; c++) syn->lex[c] = SEPARATORS[c] ? LEX_SEP : 0;
+        if(syn->flags & HL_HIGHLIGHT_NUMBERS){
+                for(int c = '0'; c <= '9'; c++) syn->lex[c] |= LEX_DIGIT;
+                syn->lex['.'] |= LEX_DOT;
+        }
+        if((syn->flags & HL_HIGHLIGHT_STRINGS) && syn->quotes){
+                for(char *q = syn->quotes; *q; q++) syn->lex[(unsigned char)*q] |= LEX_QUOTE;
+        }
+        char *scs = syn->singleline_comment_start, *mcs = syn->multiline_comment_start, *mce = syn->multiline_comment_end;
+        if(scs && scs[0]) syn->lex[(unsigned char)scs[0]] |= LEX_COMMENT;
+        if(mcs && mcs[0] && mce && mce[0]) syn->lex[(unsigned char)mcs[0]] |= LEX_COMMENT;
+}
+
+
+/***** Syntax Files *****/
+/* Filetypes are read at startup from syntax files, each one a list of sections like this:
+
+        [lua]
+        match = .lua
+        keywords = if then else end while
+        types = nil true false
+        comment = --
+        block = --[[ ]]
+        strings = "'
+        numbers = yes
+
+match is extensions (starting with .) or anything the file name contains. keywords are HL_KEYWORD1 & types HL_KEYWORD2, both can be
+given on more lines to add more. comment starts a comment to the end of the line, block is the start & end of a multi-line comment.
+strings are the chars a string starts & ends with. A line starting with # is a comment. The files read, in order, are onree-syntax.txt
+next to the executable, ~/.onree-syntax.txt and the one ONREE_SYNTAX_FILE names. A filetype read later takes over one of the same name
+read before, the built-in C one is used when there's no file */
+void syntaxLoadFiles(){
+        static int loaded = 0;
+        if(loaded) return;
+        loaded = 1;
+
+        char path[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 32);
+        if(n > 0){
+                path[n] = '\0';
+                char *slash = strrchr(path, '/');
+                if(slash){
+                        strcpy(slash + 1, "onree-syntax.txt");
+                        syntaxLoadFile(path);
+                }
+        }
+        char *home = getenv("HOME");
+        if(home){
+                snprintf(path, sizeof(path), "%s/.onree-syntax.txt", home);
+                syntaxLoadFile(path);
+        }
+        char *env = getenv("ONREE_SYNTAX_FILE");
+        if(env) syntaxLoadFile(env);
+}
+
+/* add the filetypes in the file at path to HLDB. Returns 0 if the file can't be read. A line that makes no sense is skipped,
+the first one is shown in the status bar */
+int syntaxLoadFile(const char *path){
+        FILE *fp = fopen(path, "r");
+        if(!fp) return 0;
+
+        struct editorSyntax *syn = NULL;
+        char *line = NULL;
+        size_t cap = 0;
+        int lineno = 0;
+        char *error = NULL; // the first line that makes no sense
+        int errline = 0;
+        while(getline(&line, &cap, fp) != -1){
+                lineno++;
+                char *p = line;
+                while(isspace((unsigned char)*p)) p++;
+                if(*p == '\0' || *p == '#') continue;
+                p[strcspn(p, "\r\n")] = '\0';
+
+                if(*p == '['){ // a new filetype
+                        char *end = strchr(p, ']');
+                        if(end == NULL || end == p + 1){
+                                if(!error){ error = "expected [filetype]"; errline = lineno; }
+                                syn = NULL; // its lines are skipped
+                                continue;
+                        }
+                        *end = '\0';
+                        syn = syntaxAdd(p + 1);
+                        continue;
+                }
+
+                char *eq = strchr(p, '=');
+                if(eq == NULL || syn == NULL){
+                        if(!error){ error = syn ? "expected key = value" : "a line before the first [filetype]"; errline = lineno; }
+                        continue;
+                }
+                char *key = p, *value = eq + 1;
+                for(char *k = eq; k > key && isspace((unsigned char)k[-1]); k--) k[-1] = '\0';
+                *eq = '\0';
+                while(isspace((unsigned char)*value)) value++;
+                char *vend = value + strlen(value);
+                while(vend > value && isspace((unsigned char)vend[-1])) *--vend = '\0';
+
+                if(!strcmp(key, "match")) syn->filematch = syntaxWords(syn->filematch, value, "");
+                else if(!strcmp(key, "keywords")) syn->keywords = syntaxWords(syn->keywords, value, "");
+                else if(!strcmp(key, "types")) syn->keywords = syntaxWords(syn->keywords, value, "|"); // see keywordTableBuild()
+                else if(!strcmp(key, "comment")) syn->singleline_comment_start = strdup(value);
+                else if(!strcmp(key, "block")){
+                        char **w = syntaxWords(NULL, value, "");
+                        if(w[0] && w[1] && !w[2]){
+                                syn->multiline_comment_start = w[0];
+                                syn->multiline_comment_end = w[1];
+                        }
+                        else if(!error){ error = "block needs a start & an end"; errline = lineno; }
+                }
+                else if(!strcmp(key, "strings")){
+                        syn->quotes = strdup(value);
+                        syn->flags |= HL_HIGHLIGHT_STRINGS;
+                }
+                else if(!strcmp(key, "numbers")){
+                        if(!strcmp(value, "yes")) syn->flags |= HL_HIGHLIGHT_NUMBERS;
+                        else syn->flags &= ~HL_HIGHLIGHT_NUMBERS;
+                }
+                else if(!error){ error = "unknown key"; errline = lineno; }
+
+        }
+        if(error && !E.statusmsg[0]) editorSetStatusMessage("%s:%d: %s", path, errline, error);
+        free(line);
+        fclose(fp);
+        return 1;
+}
+
+// a new filetype at the end of HLDB, empty but for its name. Only done before any file is open, E.syntax points into HLDB
+struct editorSyntax *syntaxAdd(const char *filetype){
+        if(HLDB == HLDB_BUILTIN){ // the built-in ones are copied, the array grows from now on
+                HLDB = malloc(sizeof(HLDB_BUILTIN));
+                memcpy(HLDB, HLDB_BUILTIN, sizeof(HLDB_BUILTIN));
+        }
+        HLDB = realloc(HLDB, (HLDB_ENTRIES + 1) * sizeof(struct editorSyntax));
+        struct editorSyntax *syn = &HLDB[HLDB_ENTRIES++];
+        memset(syn, 0, sizeof(struct editorSyntax));
+        syn->filetype = strdup(filetype);
+        syn->filematch = syntaxWords(NULL, "", "");
+        syn->keywords = syntaxWords(NULL, "", "");
+        return syn;
+}
+
+// add the words of s, separated by spaces, to the NULL terminated list (a new one if list is NULL), each with suffix after it
+char **syntaxWords(char **list, const char *s, const char *suffix){
+        int n = 0;
+        while(list && list[n]) n++;
+        while(1){
+                while(isspace((unsigned char)*s)) s++;
+                if(*s == '\0') break;
+                int len = 0;
+                while(s[len] && !isspace((unsigned char)s[len])) len++;
+                char *w = malloc(len + strlen(suffix) + 1);
+                memcpy(w, s, len);
+                strcpy(w + len, suffix);
+                list = realloc(list, (n + 2) * sizeof(char *));
+                list[n++] = w;
+                s += len;
+        }
+        list = realloc(list, (n + 1) * sizeof(char *));
+        list[n] = NULL;
+        return list;
+}
+
+
+/***** Keyword Table *****/
+// FNV-1a hash of a word, mixed with seed
+unsigned int keywordHash(const char *s, int len, unsigned int seed){
+        unsigned int h = 2166136261u ^ seed;
+        for(int i = 0; i < len; i++){
+                h ^= (unsigned char)s[i];
+                h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+}
+
+/* Keywords are in the HLDB format: a '|' at the end means a common type name (HL_KEYWORD2).
+Seeds are tried until every keyword lands in its own slot, with a table at least twice as big as the # keywords that takes a few tries.
+A word given twice (kw & kw| too) lands in the same slot for every seed, the later one takes it over. Returns NULL if no table
+up to KEYWORD_TABLE_GROWTH times the first size works */
+keywordTable *keywordTableBuild(char **keywords){
+        keywordTable *t = malloc(sizeof(keywordTable));
+        int n = 0;
+        while(keywords[n]) n++;
+
+        unsigned int size = 4;
+        while(size < (unsigned int)n * 2) size *= 2;
+        unsigned int maxsize = size * KEYWORD_TABLE_GROWTH;
+        t->slots = NULL;
+        t->seed = 0;
+        for(; size <= maxsize; size *= 2){ // too crowded, try a bigger table
+                t->slots = realloc(t->slots, size * sizeof(keywordSlot));
+                t->mask = size - 1;
+                int tries;
+                for(tries = 0; tries < 1000; tries++, t->seed++){
+                        memset(t->slots, 0, size * sizeof(keywordSlot));
+                        t->minlen = INT_MAX;
+                        t->maxlen = 0;
+                        int j;
+                        for(j = 0; j < n; j++){
+                                int klen = strlen(keywords[j]);
+                                int kw2 = keywords[j][klen - 1] == '|';
+                                if(kw2) klen--;
+                                keywordSlot *slot = &t->slots[keywordHash(keywords[j], klen, t->seed) & t->mask];
+                                if(slot->word && (slot->len != klen || memcmp(slot->word, keywords[j], klen))) break; // collision, try the next seed
+                                slot->word = keywords[j];
+                                slot->len = klen;
+                                slot->type = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+                                if(klen < t->minlen) t->minlen = klen;
+                                if(klen > t->maxlen) t->maxlen = klen;
+                        }
+                        if(j == n) return t;
+                }
+        }
+        free(t->slots);
+        free(t);
+        return NULL;
+}
+
+// the keyword type of the word s (len chars), HL_NORMAL if it isn't a keyword
+int keywordLookup(keywordTable *t, const char *s, int len){
+        if(len < t->minlen || len > t->maxlen) return HL_NORMAL;
+        keywordSlot *slot = &t->slots[keywordHash(s, len, t->seed) & t->mask];
+        if(slot->word && slot->len == len && !memcmp(slot->word, s, len)) return slot->type;
+        return HL_NORMAL;
+}
+
+// the loop editorHighlightLine() used before the tables, kept to compare against in the benchmark
+int keywordLookupLinear(char **keywords, const char *s, int len){
+        for(int j = 0; keywords[j]; j++){
+                int klen = strlen(keywords[j]); // store the len of keyword
+                int kw2 = keywords[j][klen - 1] == '|'; // check to see if the last char of keyword is |, then decrement
+                if(kw2) klen--;
+                // check if keyword exist at the current position in the text & check if a separator char comes after the keyword
+                if(klen <= len && !strncmp(s, keywords[j], klen) && is_separator(klen < len ? s[klen] : '\0')) return kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+        }
+        return HL_NORMAL;
+}
+
+
+/***** Benchmarks *****/
+/* Run with ./hello --bench-keywords file.c, no terminal needed. Not part of the editor itself, these time
+the hot spots of the editor on a real file */
+double benchNow(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// look up every word of the file with the hash table and with the old loop over the keyword list
+int editorBenchKeywords(char *filename){
+        FILE *fp = fopen(filename, "r");
+        if(!fp){
+                perror(filename);
+                return 1;
+        }
+        char *buf = NULL;
+        long size = -1;
+        if(fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) != -1 && fseek(fp, 0, SEEK_SET) == 0) buf = malloc(size + 1);
+        if(buf) size = fread(buf, 1, size, fp);
+        int err = (buf == NULL || ferror(fp));
+        fclose(fp);
+        if(err){ // not a file that can be read in one piece: a pipe, or too big for memory
+                perror(filename);
+                free(buf);
+                return 1;
+        }
+        buf[size] = '\0';
+
+        // every place the highlighter would try a keyword: the start of each word. Offsets are longs, a file can be past 2GB
+        long nwords = 0, cap = 1024;
+        long *words = malloc(cap * sizeof(long));
+        int prev_sep = 1;
+        for(long i = 0; i < size; i++){
+                int sep = SEPARATORS[(unsigned char)buf[i]];
+                if(prev_sep && !sep){
+                        if(nwords == cap){
+                                long *grown = realloc(words, cap * 2 * sizeof(long));
+                                if(grown == NULL){
+                                        perror("words");
+                                        free(words);
+                                        free(buf);
+                                        return 1;
+                                }
+                                words = grown;
+                                cap *= 2;
+                        }
+                        words[nwords++] = i;
+                }
+                prev_sep = sep;
+        }
+
+        struct editorSyntax *syn = &HLDB[0];
+        int passes = 10;
+        long found_table = 0, found_linear = 0;
+        double t0 = benchNow();
+        for(int p = 0; p < passes; p++){
+                for(long w = 0; w < nwords; w++){
+                        int len = 0;
+                        while(words[w] + len < size && len < INT_MAX && !SEPARATORS[(unsigned char)buf[words[w] + len]]) len++;
+                        found_table += keywordLookup(syn->kwtable, &buf[words[w]], len) != HL_NORMAL;
+                }
+        }
+        double t1 = benchNow();
+        for(int p = 0; p < passes; p++){
+                for(long w = 0; w < nwords; w++){
+                        long rest = size - words[w];
+                        found_linear += keywordLookupLinear(syn->keywords, &buf[words[w]], rest < INT_MAX ? rest : INT_MAX) != HL_NORMAL;
+                }
+        }
+        double t2 = benchNow();
+
+        long lookups = nwords * passes;
+        printf("keywords: %ld words x %d passes, %ld keywords found (old loop found %ld)\n", nwords, passes, found_table / passes, found_linear / passes);
+        printf("hash table: %8.3f ms  %6.1f ns/word\n", (t1 - t0) * 1e3, (t1 - t0) * 1e9 / lookups);
+        printf("old loop:   %8.3f ms  %6.1f ns/word\n", (t2 - t1) * 1e3, (t2 - t1) * 1e9 / lookups);
+        free(words);
+        free(buf);
+        return found_table != found_linear;
+}
+
+/* Build frames of a file for a 100 x 250 window without a terminal, nothing is written. Three cases:
+the same page sent in full every frame, every page of the file in turn (new rows to render & highlight each frame), and
+an unchanged page, which only costs the drawing & the comparison with the frame before */
+int editorBenchRender(char *filename){
+        initEditorSize(100, 250);
+        E.headless = 1;
+        editorOpen(filename);
+        E.cachemax = E.screenrows * 2; // paging through the file shouldn't be able to keep every row rendered
+        editorRefreshScreen();
+
+        char *names[] = {"full redraw", "page down", "unchanged"};
+        for(int test = 0; test < 3; test++){
+                int frames = test == 1 ? E.numrows / E.screenrows : 2000;
+                if(frames > 2000) frames = 2000;
+                if(frames < 1) frames = 1;
+                E.cy = E.rowoff = 0;
+                long bytes = 0;
+                double t0 = benchNow();
+                for(int i = 0; i < frames; i++){
+                        if(test == 0) E.shadow_valid = 0;
+                        if(test == 1) E.cy = E.rowoff = i * E.screenrows;
+                        editorRefreshScreen();
+                        bytes += E.frame_bytes;
+                }
+                double t1 = benchNow();
+                printf("%-12s %5d frames  %8.1f us/frame  %7ld bytes/frame\n", names[test], frames, (t1 - t0) * 1e6 / frames, bytes / frames);
+        }
+        return 0;
+}
+
+/* Conversions between chars & render indexes on a long TSV line: a 1MB row, a tab every 4 to 20 chars. Random conversions both ways
+with the tab index on the row in one block, through the chunks of the row the editor keeps (it's over ROW_LONG, see Long Rows) & by going
+through the row like before the tab index, then typing in the middle of the row with a conversion after each char,
+like moving the cursor & typing does through editorScroll() */
+int editorBenchTabs(){
+        initEditorSize(100, 250);
+        E.headless = 1;
+        int size = 1 << 20;
+        char *line = malloc(size + 1);
+        unsigned int seed = 1;
+        for(int i = 0, next = 0; i < size; i++){
+                if(i == next){
+                        line[i] = '\t';
+                        seed = seed * 1103515245 + 12345;
+                        next = i + 4 + (seed >> 16) % 17;
+                }
+                else{
+                        line[i] = 'a' + i % 26;
+                }
+        }
+        line[size] = '\0';
+        editorInsertRow(0, line, size);
+        erow *row = editorRowAt(0);
+        erow flat = {.size = size, .chars = line, .ntabs = -1}; // the same chars in one block
+        int rsize = editorRowCxToRxLinear(&flat, flat.size);
+
+        int n = 2000;
+        int *cx = malloc(n * sizeof(int)), *rx = malloc(n * sizeof(int));
+        for(int i = 0; i < n; i++){
+                seed = seed * 1103515245 + 12345;
+                cx[i] = (seed >> 8) % (row->size + 1);
+                rx[i] = (seed >> 8) % (rsize + 1);
+        }
+        long check_index = 0, check_chunks = 0, check_linear = 0; // sums of the results, every way must give the same
+        double t0 = benchNow();
+        rowTabs(&flat);
+        double t1 = benchNow();
+        for(int i = 0; i < n; i++) check_index += editorRowCxToRx(&flat, cx[i]) + editorRowRxToCx(&flat, rx[i]);
+        double t2 = benchNow();
+        for(int i = 0; i < n; i++) check_chunks += editorRowCxToRx(row, cx[i]) + editorRowRxToCx(row, rx[i]);
+        double t3 = benchNow();
+        for(int i = 0; i < n; i++) check_linear += editorRowCxToRxLinear(&flat, cx[i]) + editorRowRxToCxLinear(&flat, rx[i]);
+        double t4 = benchNow();
+        printf("row of %d chars, %d tabs. Building the tab index took %.2f ms\n", flat.size, flat.ntabs, (t1 - t0) * 1e3);
+        printf("tab index: %8.3f us per conversion\n", (t2 - t1) * 1e6 / (2 * n));
+        printf("chunks:    %8.3f us per conversion\n", (t3 - t2) * 1e6 / (2 * n));
+        printf("linear:    %8.3f us per conversion\n", (t4 - t3) * 1e6 / (2 * n));
+
+        // typing in the middle of the row
+        int at = row->size / 2;
+        long typed = 0, typed_linear = 0;
+        double t5 = benchNow();
+        for(int i = 0; i < n; i++){
+                editorRowInsertChar(row, at + i, i % 8 ? 'x' : '\t');
+                typed += editorRowCxToRx(row, at + i + 1);
+        }
+        double t6 = benchNow();
+        line = realloc(line, row->size + 1); // the row after typing, to check against going through it
+        rowCopy(row, 0, row->size, line);
+        flat.chars = line;
+        flat.size = row->size;
+        for(int i = 0; i < n; i++) typed_linear += editorRowCxToRxLinear(&flat, at + i + 1); // chars typed later are after at + i + 1, they don't move it
+        printf("typing:    %8.3f us per char with a conversion after each\n", (t6 - t5) * 1e6 / n);
+        rowFree(flat.tabs, flat.tabcap * sizeof(tabStop));
+        free(line);
+        free(cx);
+        free(rx);
+        return check_index != check_linear || check_chunks != check_linear || typed != typed_linear;
+}
+
+// resident memory of the editor in KB
+long benchRSS(){
+        long size = 0, resident = 0;
+        FILE *fp = fopen("/proc/self/statm", "r");
+        if(fp == NULL) return 0;
+        if(fscanf(fp, "%ld %ld", &size, &resident) != 2) resident = 0;
+        fclose(fp);
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Memory & allocations of the rows, see Row Allocator. Every row of the file is loaded & drawn, then drawn again with every row keeping
+its render & hl, then each one has 8 chars typed at its end, is drawn, has 4 of them backspaced & is drawn again. Last the file is closed */
+int editorBenchRows(char *filename){
+        initEditorSize(100, 250);
+        E.headless = 1;
+        editorOpen(filename);
+
+        char *names[] = {"load", "keep", "edit"};
+        for(int test = 0; test < 3; test++){
+                if(test == 1) E.cachemax = E.numrows; // what a row costs once it's drawn
+                long rss = benchRSS(), blocks = ARENA.blocks, mallocs = ARENA.mallocs, grown = ARENA.grown;
+                double t0 = benchNow();
+                for(erow *row = editorRowAt(0); row; row = editorRowNext(row)){
+                        if(test == 2){
+                                for(int i = 0; i < 8; i++) editorRowInsertChar(row, row->size, 'x');
+                                editorRowRender(row);
+                                for(int i = 0; i < 4; i++) editorRowDelChar(row, row->size - 1);
+                        }
+                        editorRowRender(row);
+                }
+                double t1 = benchNow();
+                printf("%-5s %d rows: %8.1f ms  RSS %7ld -> %7ld KB  %9ld blocks  %6ld mallocs  %9ld grown in place\n", names[test], E.numrows,
+                        (t1 - t0) * 1e3, rss, benchRSS(), ARENA.blocks - blocks, ARENA.mallocs - mallocs, ARENA.grown - grown);
+        }
+
+        long rss = benchRSS();
+        double t0 = benchNow();
+        editorCloseFile();
+        double t1 = benchNow();
+        printf("close: %8.1f ms  RSS %7ld -> %7ld KB\n", (t1 - t0) * 1e3, rss, benchRSS());
+        return 0;
+}
+
+/* The benchmark suite: ./hello --bench-suite [--scale N] [--dir DIR] [--only KIND]
+Files of 4 kinds are generated into DIR (/tmp by default), the same bytes every time for a given scale, & kept there for the next run:
+a C source file (32MB x scale), minified JSON in 4MB lines (16MB x scale), a TSV file with 20 columns (32MB x scale)
+and a log (256MB x scale, so --scale 8 is a 2GB log). Each one is opened & put through the core operations with no terminal.
+Every result is one line of JSON on stdout, so runs can be compared by a script over time */
+struct benchSuite{
+        const char *corpus; // the kind of file being run
+        long bytes;
+        int rows;
+} BENCH;
+
+unsigned int benchRand(unsigned int *seed){
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 17;
+        *seed ^= *seed << 5;
+        return *seed;
+}
+
+/* write a file of kind "c", "json", "tsv" or "log" to path, at least bytes long. It's written to path.tmp & renamed once complete,
+so a run stopped halfway doesn't leave a short file behind for the next runs to time */
+void benchCorpus(const char *kind, const char *path, long bytes){
+        static const char *words[] = {"alpha", "beta", "gamma", "delta", "request", "buffer", "index", "value", "count", "total",
+                "render", "cursor", "window", "status", "parse", "token"};
+        static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        char tmp[4096 + 8];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        FILE *fp = fopen(tmp, "w");
+        if(fp == NULL){
+                perror(tmp);
+                exit(1);
+        }
+        unsigned int seed = 2463534242u;
+        char line[1024];
+        long written = 0, linelen = 0;
+        for(long i = 0; written < bytes; i++){
+                unsigned int r = benchRand(&seed);
+                const char *w1 = words[r % 16], *w2 = words[(r >> 4) % 16], *w3 = words[(r >> 8) % 16];
+                int n = 0;
+                if(!strcmp(kind, "c")){
+                        switch(i % 10){
+                                case 0: n = sprintf(line, "/* %s %s: a block comment\n", w1, w2); break;
+                                case 1: n = sprintf(line, " * that goes on for %u lines */\n", r % 9 + 2); break;
+                                case 2: n = sprintf(line, "static int %s_%s_%ld(int %s, const char *%s){\n", w1, w2, i, w3, w1); break;
+                                case 3: n = sprintf(line, "\tint %s = %u + %s; // %s the %s\n", w2, r % 1000, w3, w1, w2); break;
+                                case 4: n = sprintf(line, "\tif(%s > %u) return strlen(\"%s %s\\n\");\n", w2, r % 100, w1, w3); break;
+                                case 5: n = sprintf(line, "\tfor(int i = 0; i < %u; i++) %s += i * 0x%x;\n", r % 64, w2, r & 0xffff); break;
+                                case 6: n = sprintf(line, "\twhile(%s-- > 0) %s_%s(%s, '%c');\n", w2, w1, w3, w2, 'a' + r % 26); break;
+                                case 7: n = sprintf(line, "\treturn %s;\n", w2); break;
+                                case 8: n = sprintf(line, "}\n"); break;
+                                default: n = sprintf(line, "\n"); break;
+                        }
+                }
+                else if(!strcmp(kind, "json")){
+                        n = sprintf(line, "%s{\"id\":%ld,\"name\":\"%s %s\",\"tags\":[\"%s\",\"%s\"],\"value\":%u.%02u,\"active\":%s}",
+                                linelen ? "," : "[", i, w1, w2, w3, w1, r % 10000, (r >> 16) % 100, r & 1 ? "true" : "false");
+                        linelen += n;
+                        if(linelen >= BENCH_JSON_LINE){
+                                n += sprintf(line + n, "]\n");
+                                linelen = 0;
+                        }
+                }
+                else if(!strcmp(kind, "tsv")){
+                        for(int col = 0; col < 20; col++){
+                                r = benchRand(&seed);
+                                if(col % 3 == 0) n += sprintf(line + n, "%u", r % 100000);
+                                else if(col % 3 == 1) n += sprintf(line + n, "%s", words[r % 16]);
+                                else n += sprintf(line + n, "%u.%03u", r % 1000, (r >> 10) % 1000);
+                                line[n++] = col == 19 ? '\n' : '\t';
+                        }
+                }
+                else{
+                        n = sprintf(line, "2026-10-%02ld %02ld:%02ld:%02ld.%03ld [%s] worker-%u %s id=%ld path=/api/v1/%s/%u took %ums status=%d\n",
+                                i / 8640000 % 28 + 1, i / 360000 % 24, i / 6000 % 60, i / 100 % 60, i % 1000, levels[r % 6], r % 16, w1,
+                                i, w2, (r >> 8) % 100000, (r >> 4) % 900 + 1, r % 7 ? 200 : 500);
+                }
+                fwrite(line, 1, n, fp);
+                written += n;
+        }
+        if(!strcmp(kind, "json") && linelen) fwrite("]\n", 1, 2, fp);
+        int err = ferror(fp);
+        if(fclose(fp) != 0) err = 1;
+        if(err || rename(tmp, path) == -1){ // a full disk shouldn't leave a short file either
+                perror(tmp);
+                unlink(tmp);
+                exit(1);
+        }
+}
+
+// one line of JSON: what ran on which file, how many times & how long it took. extra is more fields, starting with a comma
+void benchResult(const char *bench, long n, double seconds, const char *extra){
+        printf("{\"corpus\":\"%s\",\"bytes\":%ld,\"rows\":%d,\"bench\":\"%s\",\"n\":%ld,\"ms\":%.3f,\"us_per_op\":%.3f%s}\n",
+                BENCH.corpus, BENCH.bytes, BENCH.rows, bench, n, seconds * 1e3, n ? seconds * 1e6 / n : 0.0, extra ? extra : "");
+        fflush(stdout);
+}
+
+// every benchmark on one file
+void benchSuiteCorpus(const char *kind, const char *path){
+        char extra[128];
+        initEditorSize(50, 200);
+        E.headless = 1;
+        BENCH.corpus = kind;
+
+        // open: mapping the file & finding every line
+        double t0 = benchNow();
+        editorOpen((char *)path);
+        double t1 = benchNow();
+        BENCH.bytes = E.mapsize;
+        BENCH.rows = E.numrows;
+        snprintf(extra, sizeof(extra), ",\"mb_per_s\":%.1f", E.mapsize / BENCH_MB / (t1 - t0));
+        benchResult("open", 1, t1 - t0, extra);
+
+        /* highlight: every line through editorHighlightLine(), with the multi-line comment state carried from line to line.
+        Lines are read with row positions, nothing is loaded, so this works the same on a file of any size. A line still in the mapped file
+        isn't followed by a '\0', so it's copied to line first, as the lexer needs */
+        unsigned char *hl = NULL;
+        char *line = NULL;
+        int hlsize = 0, in_comment = 0;
+        rowPos p;
+        rowPosAt(&p, 0);
+        t0 = benchNow();
+        do{
+                int len;
+                char *s = rowPosText(&p, &len);
+                if(len + 1 > hlsize){
+                        hlsize = len * 2 + 64;
+                        hl = realloc(hl, hlsize);
+                        line = realloc(line, hlsize);
+                }
+                memcpy(line, s, len);
+                line[len] = '\0';
+                in_comment = editorHighlightLine(line, len, hl, in_comment);
+        } while(rowPosNext(&p));
+        t1 = benchNow();
+        free(hl);
+        free(line);
+        snprintf(extra, sizeof(extra), ",\"mb_per_s\":%.1f", E.mapsize / BENCH_MB / (t1 - t0));
+        benchResult("highlight", E.numrows, t1 - t0, extra);
+
+        // load: the first rows loaded & drawn one after another, what scrolling through the file does
+        int rows = E.numrows < 100000 ? E.numrows : 100000, n = 0;
+        t0 = benchNow();
+        for(erow *row = editorRowAt(0); row && n < rows; row = editorRowNext(row), n++) editorRowRender(row);
+        t1 = benchNow();
+        benchResult("load", n, t1 - t0, NULL);
+
+        /* rehighlight: the multi-line comment state of every row down to the last loaded one redone at once, what a new filetype does (Save As x.c).
+        Row 1M (or the last) is loaded for it, the rows above are read where they are. serial_ms is the same rows done one after another, to see how it scales with the cores */
+        rows = E.numrows < 1000000 ? E.numrows : 1000000;
+        editorRowAt(rows - 1);
+        t0 = benchNow();
+        editorSelectSyntaxHighlight();
+        t1 = benchNow();
+        rowLongMarkAll();
+        in_comment = 0;
+        double s0 = benchNow();
+        rowPosAt(&p, 0);
+        for(int i = 0; i < rows; i++){
+                in_comment = rowPosEndState(&p, in_comment);
+                rowPosNext(&p);
+        }
+        double s1 = benchNow();
+        snprintf(extra, sizeof(extra), ",\"threads\":%d,\"serial_ms\":%.3f", poolThreads(), (s1 - s0) * 1e3);
+        benchResult("rehighlight", rows, t1 - t0, extra);
+
+        // typing in the middle of the first, middle & last row: insert, tab index, render cache, multi-line comment state & undo
+        char *where[] = {"insert_start", "insert_middle", "insert_end"};
+        int at[] = {0, E.numrows / 2, E.numrows - 1};
+        for(int w = 0; w < 3; w++){
+                E.cy = at[w];
+                E.cx = editorRowAt(E.cy)->size / 2;
+                t0 = benchNow();
+                for(int i = 0; i < 2000; i++) editorInsertChar('a' + i % 26);
+                t1 = benchNow();
+                benchResult(where[w], 2000, t1 - t0, NULL);
+        }
+
+        // splitting a row in the middle & joining it back with backspace
+        E.cy = E.numrows / 2;
+        int cx = editorRowAt(E.cy)->size / 2;
+        t0 = benchNow();
+        for(int i = 0; i < 200; i++){
+                E.cx = cx;
+                editorInsertNewLine();
+                editorDelChar();
+        }
+        t1 = benchNow();
+        benchResult("split_join", 200, t1 - t0, NULL);
+
+        /* incremental search: a query typed a char at a time in the prompt. "first" is until the prompt shows the first match,
+        what the user waits for on each key. "all" is until every match in the file is found */
+        const char *query = !strcmp(kind, "c") ? "return" : !strcmp(kind, "json") ? "\"name\":\"delta" : !strcmp(kind, "tsv") ? "gamma" : "ERROR";
+        matchIndex *mi = &E.matches;
+        mi->active = 1;
+        mi->origin_row = mi->origin_cx = 0;
+        searchSnapshot(mi);
+        double first = 0, all = 0;
+        int keys = strlen(query);
+        char prefix[64];
+        for(int k = 1; k <= keys; k++){
+                memcpy(prefix, query, k);
+                prefix[k] = '\0';
+                t0 = benchNow();
+                searchStart(mi, prefix);
+                searchPoll(mi);
+                t1 = benchNow();
+                while(mi->job){
+                        poolWait(&mi->job->group);
+                        searchPoll(mi);
+                }
+                first += t1 - t0;
+                all += benchNow() - t0;
+        }
+        snprintf(extra, sizeof(extra), ",\"matches\":%d", mi->n);
+        benchResult("search_first", keys, first, extra);
+        benchResult("search_all", keys, all, extra);
+        matchIndexFree(mi);
+
+        // whole frames written to /dev/null from 200 places in the file
+        E.headless = 0;
+        E.outfd = open("/dev/null", O_WRONLY);
+        long bytes = 0;
+        t0 = benchNow();
+        for(int i = 0; i < 200; i++){
+                E.cy = E.rowoff = (long)E.numrows * i / 200;
+                E.cx = 0;
+                E.shadow_valid = 0;
+                editorRefreshScreen();
+                bytes += E.frame_bytes;
+        }
+        t1 = benchNow();
+        close(E.outfd);
+        snprintf(extra, sizeof(extra), ",\"bytes_per_frame\":%ld", bytes / 200);
+        benchResult("frame", 200, t1 - t0, extra);
+
+        // replace all: the search query replaced everywhere with a longer string, one undo group. Last, the rows it loads stay loaded
+        E.headless = 1;
+        E.cy = E.cx = 0;
+        t0 = benchNow();
+        n = editorReplaceAll((char *)query, "REPLACED");
+        t1 = benchNow();
+        snprintf(extra, sizeof(extra), ",\"matches\":%d", n);
+        benchResult("replace_all", n, t1 - t0, extra);
+
+        editorCloseFile();
+}
+
+int editorBenchSuite(int argc, char *argv[]){
+        int scale = 1;
+        char *dir = "/tmp", *only = NULL;
+        for(int i = 2; i < argc; i++){
+                if(!strcmp(argv[i], "--scale") && i + 1 < argc) scale = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "--dir") && i + 1 < argc) dir = argv[++i];
+                else if(!strcmp(argv[i], "--only") && i + 1 < argc) only = argv[++i];
+        }
+        if(scale < 1) scale = 1;
+
+        struct{ const char *kind, *ext; long mb; } corpora[] = {{"c", "c", 32}, {"json", "json", 16}, {"tsv", "tsv", 32}, {"log", "log", 256}};
+        for(int i = 0; i < 4; i++){
+                if(only && strcmp(only, corpora[i].kind)) continue;
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/onree-bench-%s-x%d.%s", dir, corpora[i].kind, scale, corpora[i].ext);
+                if(access(path, R_OK) != 0){
+                        fprintf(stderr, "generating %s\n", path);
+                        benchCorpus(corpora[i].kind, path, corpora[i].mb * scale * BENCH_MB);
+                }
+                benchSuiteCorpus(corpora[i].kind, path);
+        }
+        return 0;
+}
+
 /* function that tries to match the current filename to one of the filematch fields in the HLDB. If one matches, it’ll set E.syntax to that filetype. Call this function whenever E.filename changes. This is in editorOpen() and editorSave() */
 void editorSelectSyntaxHighlight(){
         E.syntax = NULL;
+        E.hl_from = E.hl_to = -1;
+        E.hl_known = 0; // no row has a state for the new filetype yet
+        for(erow *row = E.cache_head; row; row = row->cache_next){ // the highlighting on screen is for the old filetype
+                editorRowDropHighlight(row);
+        }
+        rowLongMarkAll(); // so are the states the chunks of long rows end in
         if(E.filename == NULL) return; // if there's no filename, there's no filetype
 
         char *ext = strrchr(E.filename, '.'); // locate the the last occurence of char
 
-        for(unsigned int j = 0; j < HLDB_ENTRIES; j++){
+        for(unsigned int j = HLDB_ENTRIES; j-- > 0; ){ // last first, so a syntax file can take over a filetype defined before it
                 struct editorSyntax *s = &HLDB[j]; // s point to the current editorSyntax structure in the HLDB array.
                 unsigned int i = 0;
                 while(s->filematch[i]){
@@ -1292,11 +6270,13 @@ void editorSelectSyntaxHighlight(){
                         if((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))){
                                 E.syntax = s; // if match all the rules, set it to editorSyntax struct
 
-                                // rehighlight the entire file after setting E.syntax in editorSelectSyntaxHighlight(). The highlighting immediately changes when the filetype changes.
-                                int filerow;
-                                for(filerow = 0; filerow < E.numrows; filerow++){
-                                        editorUpdateSyntax(&E.row[filerow]);
-                                }
+                                /* redo the multi-line comment state of the loaded rows after setting E.syntax in editorSelectSyntaxHighlight(), on every core,
+                                see editorSyntaxAll(), with the unloaded lines in between read from the mapped file. Rows below the last loaded one
+                                get their state when they're needed, see editorSyntaxKnow() */
+                                rowNode *n = E.rows;
+                                while(n && n->right) n = n->right;
+                                while(n && n->fileline != -1) n = rowNodePrev(n);
+                                if(n) editorSyntaxAll(0, rowNodeIndex(n));
 
                                 return;
                         }